@@ -0,0 +1,410 @@
+#include "Vcs_oops.h"
+
+using namespace std;
+
+VCS::VCS(istream& in, bool inter)
+    : repo(Repository::getInstance()), input(&in), interactive(inter) {
+    for (const auto& f : repo.stagedFiles) workingFiles.insert(f);
+}
+
+bool VCS::runCommand(const string& cmd) {
+    repo.refresh();
+    if (cmd.rfind("add ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(4));
+        if (args.empty()) { cout << "Usage: add <file|dir|glob>..." << endl; return false; }
+        bool ok = true;
+        for (const string& arg : args) {
+            if (!hasWildcard(arg)) {
+                string path = normalPath(arg);
+                ok = (fs::is_directory(arg) ? addDirectory(path) : addPath(path)) && ok;
+                continue;
+            }
+            vector<string> matches = expandGlob(arg);
+            if (matches.empty()) { cout << "No files match " << arg << endl; ok = false; }
+            for (const string& m : matches) ok = addPath(normalPath(m)) && ok;
+        }
+        repo.keepStaging();
+        return ok;
+    } 
+    else if (cmd.rfind("edit ", 0) == 0) {
+        string fname = cmd.substr(5);
+        if (shared_ptr<File> f = workingFiles.find(fname)) {
+            bool ok = editFile(f);
+            repo.keepStaging();
+            return ok;
+        }
+        cout << "File not found in working directory!" << endl;
+        return false;
+    } 
+    else if (cmd.rfind("commit ", 0) == 0) {
+        string msg = cmd.substr(7);
+        bool ok = repo.commit(msg);
+        if (ok && interactive) repo.backgroundGc();
+        return ok;
+    } 
+    else if (cmd == "log" || cmd.rfind("log ", 0) == 0) {
+        LogOptions opts;
+        vector<string> args = splitArgs(cmd.substr(3));
+        for (size_t i = 0; i < args.size(); ++i) {
+            bool hasValue = i + 1 < args.size();
+            if (args[i] == "--oneline") opts.oneline = true;
+            else if (args[i] == "--limit" && hasValue) {
+                if (!parseNumber(args[++i], opts.limit)) { cout << "Invalid limit: " << args[i] << endl; return false; }
+            }
+            else if (args[i] == "--grep" && hasValue) opts.grep = args[++i];
+            else if (args[i] == "--since" && hasValue) {
+                if (!parseDate(args[++i], opts.since)) { cout << "Invalid date: " << args[i] << endl; return false; }
+            } else {
+                cout << "Usage: log [--oneline] [--limit <n>] [--since <YYYY-MM-DD|unix time>] [--grep <text>]" << endl;
+                return false;
+            }
+        }
+        repo.log(opts);
+        return true;
+    } 
+    else if (cmd == "status") {
+        repo.status(workingFiles);
+        return true;
+    } 
+    else if (cmd.rfind("diff ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(5));
+        int from, to;
+        if (args.size() != 2 || !resolve(args[0], from) || !resolve(args[1], to)) {
+            cout << "Usage: diff <id|branch|hash> <id|branch|hash>" << endl;
+            return false;
+        }
+        return repo.diff(from, to);
+    } 
+    else if (cmd == "stats" || cmd.rfind("stats ", 0) == 0) {
+        return showStats(splitArgs(cmd.substr(5)));
+    } 
+    else if (cmd == "gc" || cmd == "gc --auto") {
+        repo.gc(cmd != "gc");
+        return true;
+    } 
+    else if (cmd.rfind("checkout ", 0) == 0) {
+        string arg = cmd.substr(9);
+        bool force = arg.rfind("--force ", 0) == 0;
+        if (force) arg = arg.substr(8);
+        int id;
+        if (parseId(arg, id)) return repo.checkout(id, workingFiles, force);
+        id = repo.branchTip(arg);
+        if (id < 0) {
+            if ((id = commitByHash(arg)) > 0) return repo.checkout(id, workingFiles, force);
+            if (id == 0) cout << "No such commit or branch: " << arg << endl;
+            return false;
+        }
+        if (id == 0) { cout << "Branch " << arg << " has no commits yet." << endl; return false; }
+        return repo.checkout(id, workingFiles, force, arg);
+    } 
+    else if (cmd == "branch") {
+        repo.listBranches();
+        return true;
+    } 
+    else if (cmd.rfind("branch ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(7));
+        int at = repo.head();
+        if (args.empty() || args.size() > 2 || (args.size() == 2 && !resolve(args[1], at))) {
+            cout << "Usage: branch [<name> [<id|branch>]]" << endl;
+            return false;
+        }
+        return repo.createBranch(args[0], at);
+    } 
+    else if (cmd.rfind("push ", 0) == 0 || cmd.rfind("pull ", 0) == 0) {
+        bool push = cmd.rfind("push ", 0) == 0;
+        vector<string> args = splitArgs(cmd.substr(5));
+        if (args.empty() || args.size() > 2 || (args.size() == 2 && !Refs::validName(args[1]))) {
+            cout << "Usage: " << cmd.substr(0, 4) << " <host:dir|dir> [<branch>]" << endl;
+            return false;
+        }
+        string branch = args.size() == 2 ? args[1] : repo.refs.branch();
+        if (branch.empty()) {
+            cout << "HEAD is detached; name the branch to " << cmd.substr(0, 4) << "." << endl;
+            return false;
+        }
+        return push ? repo.push(args[0], branch) : repo.pull(args[0], branch, workingFiles);
+    }
+    else {
+        cout << "Unknown command!" << endl;
+        return false;
+    }
+}
+
+bool VCS::runBatch(const vector<string>& lines, bool single) {
+    for (size_t i = 0; i < lines.size(); ++i) {
+        string problem = checkBatchLine(lines, i);
+        if (!problem.empty()) {
+            if (single) cout << char(toupper(problem[0])) << problem.substr(1) << "." << endl;
+            else cout << "Batch line " << i + 1 << ": " << problem << ". Nothing was run." << endl;
+            return false;
+        }
+        if (lines[i].rfind("edit ", 0) == 0) ++i;
+    }
+
+    string text;
+    for (const string& line : lines) text += line + "\n";
+    istringstream script(text);
+    istream* previous = input;
+    input = &script;
+
+    if (!repo.beginTransaction()) {
+        input = previous;
+        return false;
+    }
+    bool ok = true;
+    string line;
+    while (ok && getline(script, line)) {
+        if (isBlankOrComment(line)) continue;
+        ok = runCommand(line);
+    }
+    input = previous;
+    if (!repo.endTransaction(ok)) {
+        // A failed command has said why.
+        if (single && ok) cout << "Failed: could not write history. Nothing was recorded." << endl;
+        else if (!single) cout << (ok ? "Batch failed: could not write history." : "Batch failed: command '" + line + "'.")
+             << " No commits from this batch were recorded." << endl;
+        return false;
+    }
+    return true;
+}
+
+bool VCS::isBlankOrComment(const string& line) {
+    size_t p = line.find_first_not_of(" \t\r");
+    return p == string::npos || line[p] == '#';
+}
+
+string VCS::checkBatchLine(const vector<string>& lines, size_t i) {
+    const string& cmd = lines[i];
+    if (isBlankOrComment(cmd)) return "";
+    if (cmd.rfind("add ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(4));
+        if (args.empty()) return "add needs a path";
+        for (const string& arg : args) {
+            if (hasWildcard(arg) ? expandGlob(arg).empty() : !fs::is_regular_file(arg) && !fs::is_directory(arg))
+                return "no file matches " + arg;
+        }
+        return "";
+    }
+    if (cmd.rfind("edit ", 0) == 0) return i + 1 < lines.size() ? "" : "edit needs a content line after it";
+    if (cmd == "stats" || cmd.rfind("stats ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(5));
+        bool ok = args.empty() || (args.size() == 1 && (args[0] == "--json" || args[0] == "--reset"))
+            || (args.size() == 2 && args[0] == "--trace");
+        return ok ? "" : "stats takes --json, --reset or --trace <file>";
+    }
+    if (cmd.rfind("commit ", 0) == 0 || cmd == "status" || cmd == "gc" || cmd == "gc --auto" || cmd == "log" || cmd.rfind("log ", 0) == 0) return "";
+    // Branches may be created earlier in the same script, so revisions
+    // are only checked for form here.
+    auto isRevision = [](const string& r) { int id; return parseId(r, id) || Refs::validName(r) || CommitLog::isHashPrefix(r); };
+    if (cmd.rfind("diff ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(5));
+        return args.size() == 2 && isRevision(args[0]) && isRevision(args[1]) ? "" : "diff needs two commits or branches";
+    }
+    if (cmd == "branch") return "";
+    if (cmd.rfind("branch ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(7));
+        bool ok = !args.empty() && args.size() <= 2 && Refs::validName(args[0]) && (args.size() == 1 || isRevision(args[1]));
+        return ok ? "" : "branch needs a valid name";
+    }
+    if (cmd.rfind("push ", 0) == 0 || cmd.rfind("pull ", 0) == 0) {
+        vector<string> args = splitArgs(cmd.substr(5));
+        bool ok = !args.empty() && args.size() <= 2 && (args.size() == 1 || Refs::validName(args[1]));
+        return ok ? "" : cmd.substr(0, 4) + " needs a repository and at most a branch";
+    }
+    if (cmd.rfind("checkout ", 0) == 0) {
+        string arg = cmd.substr(9);
+        if (arg.rfind("--force ", 0) == 0) arg = arg.substr(8);
+        return isRevision(arg) ? "" : "invalid commit or branch " + arg;
+    }
+    return "unknown command '" + cmd + "'";
+}
+
+bool VCS::parseId(const string& s, int& id) {
+    if (s.empty() || !all_of(s.begin(), s.end(), ::isdigit) || s.size() > 9) return false;
+    id = stoi(s);
+    return true;
+}
+
+bool VCS::showStats(const vector<string>& args) {
+#ifdef VCSIM_NO_STATS
+    (void)args;
+    cout << "Statistics were compiled out (VCSIM_NO_STATS)." << endl;
+    return false;
+#else
+    Stats& stats = Stats::get();
+    if (args.empty()) stats.report(cout);
+    else if (args.size() == 1 && args[0] == "--json") stats.writeJson(cout);
+    else if (args.size() == 1 && args[0] == "--reset") { stats.reset(); cout << "Statistics reset." << endl; }
+    else if (args.size() == 2 && args[0] == "--trace") {
+        if (!stats.tracing()) { cout << "Tracing is off; set VCSIM_TRACE=<file> to record events." << endl; return false; }
+        if (!stats.writeTrace(args[1])) { cout << "Could not write " << args[1] << endl; return false; }
+        cout << "Trace written to " << args[1] << "." << endl;
+    } else {
+        cout << "Usage: stats [--json | --reset | --trace <file>]" << endl;
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool VCS::resolve(const string& rev, int& id) const {
+    if (parseId(rev, id)) return true;
+    id = repo.branchTip(rev);
+    if (id < 0) id = commitByHash(rev);
+    return id > 0;
+}
+
+int VCS::commitByHash(const string& rev) const {
+    int id = repo.commitByHash(rev);
+    if (id < 0) cout << "Ambiguous commit hash " << rev << "; give more digits." << endl;
+    return id;
+}
+
+string VCS::normalPath(const string& arg) {
+    string path = fs::path(arg).lexically_normal().generic_string();
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    return path == "." ? "" : path;
+}
+
+vector<string> VCS::expandGlob(const string& pattern) {
+    fs::path p(pattern);
+    fs::path dir = p.parent_path();
+    string leaf = p.filename().string();
+    vector<string> matches;
+    error_code ec;
+    for (fs::directory_iterator it(dir.empty() ? fs::path(".") : dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        string name = it->path().filename().string();
+        if (IgnoreRules::globMatch(leaf.c_str(), name.c_str())) matches.push_back(dir.empty() ? name : (dir / name).string());
+    }
+    sort(matches.begin(), matches.end());
+    return matches;
+}
+
+bool VCS::addPath(const string& fname) {
+    // The file is only reread if its stat data changed since it was last seen.
+    shared_ptr<File> loaded;
+    repo.readIfChanged(fname, loaded);
+    return stagePath(fname, move(loaded), true) != nullptr;
+}
+
+bool VCS::addDirectory(const string& dir) {
+    string shown = dir.empty() ? "." : dir;
+    IgnoreRules ignore;
+    ignore.load(".vcsignore");
+    vector<string> paths = repo.walk(dir, ignore);
+    if (paths.empty()) { cout << "No files to add under " << shown << endl; return false; }
+    vector<shared_ptr<File>> loaded;
+    repo.readChanged(paths, loaded);
+    size_t added = 0, changed = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (shared_ptr<File> f = stagePath(paths[i], move(loaded[i]), false)) {
+            ++added;
+            if (f->isModified()) ++changed;
+        }
+    }
+    cout << "Added " << added << " files under " << shown << " to staging (" << changed << " changed)." << endl;
+    return added == paths.size();
+}
+
+shared_ptr<File> VCS::stagePath(const string& fname, shared_ptr<File> loaded, bool single) {
+    if (shared_ptr<File> tracked = workingFiles.find(fname)) {
+        // The index vouches for what is on disk, which need not be what
+        // is staged (status may have seen an edit made since).
+        const StatCache::Entry* e = loaded ? nullptr : repo.index.find(fname);
+        if (e && PackFile::parseHash(e->hash) != tracked->getStagedHash()) loaded = File::loadFromDisk(fname, &repo.memory);
+        if (loaded) tracked->stageFrom(*loaded);
+        repo.addFile(tracked, single);
+        return tracked;
+    }
+
+    shared_ptr<File> f;
+    const StatCache::Entry* e = loaded ? nullptr : repo.index.find(fname);
+    // Content HEAD already holds, by the index: HEAD's copy, unread.
+    if (e && fs::is_regular_file(fname)) f = repo.committedFile(fname, e->hash);
+    if (!f && !loaded) loaded = File::loadFromDisk(fname, &repo.memory);
+    if (!f && loaded) {
+        // Staged over HEAD's version, so content equal to it is no change;
+        // a path HEAD lacks is new, its content the change to commit.
+        if ((f = repo.committedFile(fname))) {
+            f->stageFrom(*loaded);
+        } else {
+            f = move(loaded);
+            f->markModified();
+        }
+    }
+    if (!f) {
+        if (!interactive || !single) {
+            cout << "File does not exist: " << fname << endl;
+            return nullptr;
+        }
+        cout << "File does not exist on disk. Create new? (y/n): ";
+        char ch; *input >> ch; input->ignore();
+        if (ch == 'y' || ch == 'Y') {
+            f = repo.memory.make<TextFile>(fname);
+            ofstream out(fname); out.close();
+            repo.recordOnDisk(f);
+            cout << "File created." << endl;
+            cout << "Do you want to edit now? (y/n): ";
+            *input >> ch; input->ignore();
+            if (ch == 'y' || ch == 'Y') editFile(f);
+        } else return nullptr;
+    }
+
+    workingFiles.insert(f);
+
+    repo.addFile(f, single);
+    return f;
+}
+
+vector<string> VCS::splitArgs(const string& s) {
+    vector<string> args;
+    string cur;
+    bool quoted = false, any = false;
+    for (char c : s) {
+        if (c == '"') { quoted = !quoted; any = true; }
+        else if (isspace(static_cast<unsigned char>(c)) && !quoted) {
+            if (any) args.push_back(cur);
+            cur.clear();
+            any = false;
+        } else { cur += c; any = true; }
+    }
+    if (any) args.push_back(cur);
+    return args;
+}
+
+bool VCS::parseDate(const string& s, time_t& out) {
+    if (!s.empty() && all_of(s.begin(), s.end(), ::isdigit)) return parseNumber(s, out);
+    tm t = {};
+    istringstream in(s);
+    in >> get_time(&t, "%Y-%m-%d");
+    if (in.fail()) return false;
+    t.tm_isdst = -1;
+    out = mktime(&t);
+    return out != time_t(-1);
+}
+
+bool VCS::editFile(const shared_ptr<File>& f) {
+    if (dynamic_cast<BinaryFile*>(f.get())) {
+        cout << f->getName() << " is a binary file; change it on disk and add it again." << endl;
+        return false;
+    }
+    if (interactive) cout << "Enter new content for " << f->getName() << ": ";
+    string newContent;
+    if (!getline(*input, newContent)) {
+        cout << "No content given for " << f->getName() << endl;
+        return false;
+    }
+    f->updateContent(move(newContent));
+
+    cout << f->getName() << " updated in memory (not saved to disk)." << endl;
+    cout << "Note: Changes are staged. Use 'commit <msg>' to save these changes permanently." << endl;
+
+    repo.addFile(f);
+    return true;
+}
+
+void VCS::showWorkingFiles() {
+    cout << "Current Working Files:" << endl;
+    for (const auto& f : workingFiles) f->showContent();
+}
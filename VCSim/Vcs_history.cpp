@@ -0,0 +1,822 @@
+#include "Vcs_oops.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+LineDiff::HashSet::HashSet(const vector<uint64_t>& keys) {
+    size_t cap = 16;
+    while (cap < keys.size() * 2) cap <<= 1;
+    slots.assign(cap, 0);
+    mask = cap - 1;
+    for (uint64_t k : keys) {
+        if (k == 0) { hasZero = true; continue; }
+        size_t i = k & mask;
+        while (slots[i] != 0 && slots[i] != k) i = (i + 1) & mask;
+        slots[i] = k;
+    }
+}
+
+bool LineDiff::HashSet::contains(uint64_t k) const {
+    if (k == 0) return hasZero;
+    for (size_t i = k & mask; slots[i] != 0; i = (i + 1) & mask)
+        if (slots[i] == k) return true;
+    return false;
+}
+
+void LineDiff::split(const string& s, vector<string_view>& lines, vector<uint64_t>& hashes) {
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t nl = s.find('\n', start);
+        size_t end = nl == string::npos ? s.size() : nl + 1;
+        lines.emplace_back(s.data() + start, end - start);
+        hashes.push_back(FastHash::of(lines.back()));
+        start = end;
+    }
+}
+
+pair<size_t, size_t> LineDiff::bisect(size_t a0, size_t a1, size_t b0, size_t b1) {
+    long n = long(a1 - a0), m = long(b1 - b0);
+    long maxD = (n + m + 1) / 2, off = maxD + 1, delta = n - m;
+    if (v1.size() < size_t(2 * off + 1)) {
+        v1.resize(2 * off + 1, -1);
+        v2.resize(2 * off + 1, -1);
+    }
+    long reached = 0;
+    auto done = [&](size_t x, size_t y) {
+        for (long i = max(0L, off - reached - 1); i <= min(2 * off, off + reached + 1); ++i) v1[i] = v2[i] = -1;
+        return make_pair(x, y);
+    };
+    v1[off + 1] = 0;
+    v2[off + 1] = 0;
+    bool front = delta % 2 != 0;
+    long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+    for (long d = 0; d < maxD; ++d) {
+        reached = d;
+        for (long k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+            long i = off + k1;
+            long x1 = (k1 == -d || (k1 != d && v1[i - 1] < v1[i + 1])) ? v1[i + 1] : v1[i - 1] + 1;
+            long y1 = x1 - k1;
+            while (x1 < n && y1 < m && a[a0 + x1] == b[b0 + y1]) { ++x1; ++y1; }
+            v1[i] = x1;
+            if (x1 > n) k1end += 2;
+            else if (y1 > m) k1start += 2;
+            else if (front) {
+                long j = off + delta - k1;
+                if (j >= 0 && j <= 2 * off && v2[j] != -1 && x1 >= n - v2[j])
+                    return done(a0 + x1, b0 + y1);
+            }
+        }
+        for (long k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+            long i = off + k2;
+            long x2 = (k2 == -d || (k2 != d && v2[i - 1] < v2[i + 1])) ? v2[i + 1] : v2[i - 1] + 1;
+            long y2 = x2 - k2;
+            while (x2 < n && y2 < m && a[a1 - x2 - 1] == b[b1 - y2 - 1]) { ++x2; ++y2; }
+            v2[i] = x2;
+            if (x2 > n) k2end += 2;
+            else if (y2 > m) k2start += 2;
+            else if (!front) {
+                long j = off + delta - k2;
+                if (j >= 0 && j <= 2 * off && v1[j] != -1) {
+                    long x1 = v1[j], y1 = x1 - (j - off);
+                    if (x1 >= n - x2) return done(a0 + x1, b0 + y1);
+                }
+            }
+        }
+    }
+    return done(a1, b0);  // nothing in common: delete all of a, insert all of b
+}
+
+void LineDiff::compare(size_t a0, size_t a1, size_t b0, size_t b1) {
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0]) { ++a0; ++b0; }
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1]) { --a1; --b1; }
+    if (a0 == a1 || b0 == b1) {
+        for (size_t i = a0; i < a1; ++i) deleted[aAt[i]] = 1;
+        for (size_t j = b0; j < b1; ++j) inserted[bAt[j]] = 1;
+        return;
+    }
+    pair<size_t, size_t> mid = bisect(a0, a1, b0, b1);
+    compare(a0, mid.first, b0, mid.second);
+    compare(mid.first, a1, mid.second, b1);
+}
+
+void LineDiff::writeLine(ostream& os, char tag, string_view line) {
+    os << tag << line;
+    if (line.empty() || line.back() != '\n') os << "\n\\ No newline at end of file\n";
+}
+
+LineDiff::LineDiff(const string& before, const string& after) {
+    vector<uint64_t> ha, hb;
+    split(before, aLines, ha);
+    split(after, bLines, hb);
+    deleted.assign(aLines.size(), 0);
+    inserted.assign(bLines.size(), 0);
+    HashSet inA(ha), inB(hb);
+    for (size_t i = 0; i < ha.size(); ++i) {
+        if (inB.contains(ha[i])) { a.push_back(ha[i]); aAt.push_back(i); }
+        else deleted[i] = 1;
+    }
+    for (size_t j = 0; j < hb.size(); ++j) {
+        if (inA.contains(hb[j])) { b.push_back(hb[j]); bAt.push_back(j); }
+        else inserted[j] = 1;
+    }
+    compare(0, a.size(), 0, b.size());
+}
+
+bool LineDiff::empty() const {
+    return find(deleted.begin(), deleted.end(), 1) == deleted.end()
+        && find(inserted.begin(), inserted.end(), 1) == inserted.end();
+}
+
+void LineDiff::writeUnified(ostream& os, size_t context) const {
+    struct Change { size_t a0, a1, b0, b1; };
+    vector<Change> changes;
+    size_t n = aLines.size(), m = bLines.size(), i = 0, j = 0;
+    while (i < n || j < m) {
+        if (i < n && j < m && !deleted[i] && !inserted[j]) { ++i; ++j; continue; }
+        Change c{i, i, j, j};
+        while (i < n && deleted[i]) ++i;
+        while (j < m && inserted[j]) ++j;
+        c.a1 = i; c.b1 = j;
+        changes.push_back(c);
+    }
+    for (size_t h = 0; h < changes.size();) {
+        size_t last = h;
+        while (last + 1 < changes.size() && changes[last + 1].a0 - changes[last].a1 <= 2 * context) ++last;
+        size_t a0 = changes[h].a0 - min(context, changes[h].a0);
+        size_t b0 = changes[h].b0 - (changes[h].a0 - a0);
+        size_t a1 = min(n, changes[last].a1 + context);
+        size_t b1 = changes[last].b1 + (a1 - changes[last].a1);
+        os << "@@ -" << (a1 > a0 ? a0 + 1 : a0) << ',' << a1 - a0
+           << " +" << (b1 > b0 ? b0 + 1 : b0) << ',' << b1 - b0 << " @@\n";
+        size_t x = a0, y = b0;
+        for (size_t c = h; c <= last; ++c) {
+            for (; x < changes[c].a0; ++x, ++y) writeLine(os, ' ', aLines[x]);
+            for (; x < changes[c].a1; ++x) writeLine(os, '-', aLines[x]);
+            for (; y < changes[c].b1; ++y) writeLine(os, '+', bLines[y]);
+        }
+        for (; x < a1; ++x, ++y) writeLine(os, ' ', aLines[x]);
+        h = last + 1;
+    }
+}
+
+bool CommitLog::writeAppend(const string& messages, const string& records) {
+    ofstream msgs(messagesPath, ios::binary | ios::app);
+    msgs.write(messages.data(), messages.size());
+    msgs.close();
+    if (!msgs) return false;
+    ofstream idx(indexPath, ios::binary | ios::app);
+    idx.write(records.data(), records.size());
+    idx.close();
+    return bool(idx);
+}
+
+void CommitLog::decode(const char* p, Record& r) {
+    uint32_t pad;
+    memcpy(&r.id, p, 8);
+    memcpy(&r.parent, p + 8, 8);
+    memcpy(&r.timestamp, p + 16, 8);
+    memcpy(&r.messageOffset, p + 24, 8);
+    memcpy(&r.messageLength, p + 32, 4);
+    memcpy(&pad, p + 36, 4);
+    r.tree.assign(p + 40, 16);
+}
+
+string CommitLog::encode(const Record& r) {
+    string out(RECORD_SIZE, '\0');
+    memcpy(&out[0], &r.id, 8);
+    memcpy(&out[8], &r.parent, 8);
+    memcpy(&out[16], &r.timestamp, 8);
+    memcpy(&out[24], &r.messageOffset, 8);
+    memcpy(&out[32], &r.messageLength, 4);
+    memcpy(&out[40], r.tree.data(), min<size_t>(r.tree.size(), 16));
+    return out;
+}
+
+void CommitLog::openHashes() const {
+    hashed = 0;
+    if (!hashes.open(hashesPath) || hashes.size() < HASHES_HEADER || memcmp(hashes.data(), HASHES_MAGIC, 8) != 0) return;
+    uint64_t n = read64(hashes.data() + 8);
+    if (n > persistedCount || hashes.size() != HASHES_HEADER + n * 16 || string(hashes.data() + 16, 16) != digest(n)) return;
+    hashed = size_t(n);
+}
+
+bool CommitLog::hashRecords(size_t first, size_t last, vector<pair<uint64_t, uint64_t>>& out) const {
+    vector<Record> records(last - first + 1);
+    for (size_t id = first; id <= last; ++id) if (!read(id, records[id - first])) return false;
+    uint64_t begin = records.front().messageOffset;
+    string messages(size_t(records.back().messageOffset + records.back().messageLength - begin), '\0');
+    ifstream in(messagesPath, ios::binary);
+    if (!messages.empty() && (!in.seekg(begin) || !in.read(&messages[0], messages.size()))) return false;
+    for (const Record& r : records) {
+        if (r.messageOffset < begin || r.messageOffset + r.messageLength > begin + messages.size()) return false;
+        out.emplace_back(hashOf(r, messages.substr(size_t(r.messageOffset - begin), r.messageLength)), r.id);
+    }
+    return true;
+}
+
+void CommitLog::indexHashes() const {
+    if (!hashesOpened) { hashesOpened = true; openHashes(); }
+    size_t upTo = hashed + unfiled.size();
+    if (upTo >= persistedCount) return;
+    if (!hashRecords(upTo + 1, persistedCount, unfiled)) { unfiled.resize(upTo - hashed); return; }
+    sort(unfiled.begin(), unfiled.end());
+    string out(HASHES_MAGIC, 8), at = digest(persistedCount);
+    if (at.size() != 16) return;
+    uint64_t n = persistedCount;
+    out.append(reinterpret_cast<const char*>(&n), 8);
+    out += at;
+    out.reserve(HASHES_HEADER + persistedCount * 16);
+    // Merges the two sorted runs.
+    size_t i = 0;
+    for (const auto& e : unfiled) {
+        for (; i < hashed && read64(hashEntry(i)) < e.first; ++i) out.append(hashEntry(i), 16);
+        out.append(reinterpret_cast<const char*>(&e.first), 8);
+        out.append(reinterpret_cast<const char*>(&e.second), 8);
+    }
+    for (; i < hashed; ++i) out.append(hashEntry(i), 16);
+    string tmp = hashesPath + ".tmp";
+    {
+        ofstream file(tmp, ios::binary);
+        if (!file.write(out.data(), out.size()) || !file.flush()) return;
+    }
+    error_code ec;
+    fs::rename(tmp, hashesPath, ec);
+    if (ec) return;
+    openHashes();
+    if (hashed == persistedCount) unfiled.clear();
+}
+
+bool CommitLog::open(const string& dir) {
+    indexPath = dir + "/commits.idx";
+    messagesPath = dir + "/messages";
+    hashesPath = dir + "/commits.hash";
+    if (!fs::exists(indexPath)) {
+        ofstream out(indexPath, ios::binary);
+        out.write(MAGIC, HEADER_SIZE);
+        if (!out) return false;
+    }
+    error_code ec;
+    messagesSize = fs::exists(messagesPath) ? fs::file_size(messagesPath, ec) : 0;
+    if (!mapped.open(indexPath) || mapped.size() < HEADER_SIZE || memcmp(mapped.data(), MAGIC, HEADER_SIZE) != 0)
+        return false;
+    mappedCount = count = persistedCount = (mapped.size() - HEADER_SIZE) / RECORD_SIZE;
+    persistedMessagesSize = messagesSize;
+    return true;
+}
+
+void CommitLog::refresh(bool repair) {
+    if (batching) return;
+    error_code ec;
+    uintmax_t size = fs::file_size(indexPath, ec);
+    if (ec || size < HEADER_SIZE) return;
+    if (repair && (size - HEADER_SIZE) % RECORD_SIZE != 0) {
+        size -= (size - HEADER_SIZE) % RECORD_SIZE;
+        fs::resize_file(indexPath, size, ec);
+    }
+    count = persistedCount = max(count, size_t((size - HEADER_SIZE) / RECORD_SIZE));
+    uintmax_t messages = fs::file_size(messagesPath, ec);
+    if (!ec) messagesSize = persistedMessagesSize = max<uint64_t>(messagesSize, messages);
+}
+
+bool CommitLog::read(uint64_t id, Record& r) const {
+    if (id == 0 || id > count) return false;
+    size_t offset = HEADER_SIZE + (id - 1) * RECORD_SIZE;
+    if (id > persistedCount) {
+        decode(pendingRecords.data() + (id - persistedCount - 1) * RECORD_SIZE, r);
+    } else if (id <= mappedCount) {
+        decode(mapped.data() + offset, r);
+    } else {
+        // Appended after the index was mapped.
+        char buf[RECORD_SIZE];
+        ifstream in(indexPath, ios::binary);
+        if (!in.seekg(offset) || !in.read(buf, RECORD_SIZE)) return false;
+        decode(buf, r);
+    }
+    return true;
+}
+
+bool CommitLog::read(uint64_t id, Record& r, string& message) const {
+    if (!read(id, r)) return false;
+    if (r.messageOffset >= persistedMessagesSize) {
+        message = pendingMessages.substr(r.messageOffset - persistedMessagesSize, r.messageLength);
+        return true;
+    }
+    message.assign(r.messageLength, '\0');
+    ifstream in(messagesPath, ios::binary);
+    return bool(in.seekg(r.messageOffset)) && bool(in.read(&message[0], r.messageLength));
+}
+
+uint64_t CommitLog::hashOf(const Record& r, const string& message) {
+    ContentHash::Stream s;
+    s.update("commit " + to_string(r.id) + " " + to_string(r.parent) + " " + to_string(r.timestamp) + " " + r.tree + " "
+             + to_string(message.size()) + "\n");
+    s.update(message);
+    return s.digest();
+}
+
+bool CommitLog::isHashPrefix(const string& s) {
+    return s.size() >= 4 && s.size() <= 16 && all_of(s.begin(), s.end(), [](char c) { return isdigit(c) || (c >= 'a' && c <= 'f'); });
+}
+
+int64_t CommitLog::findHash(const string& prefix) const {
+    if (!isHashPrefix(prefix)) return 0;
+    lock_guard<mutex> lock(hashesMutex);
+    indexHashes();
+    int bits = 4 * int(16 - prefix.size());
+    uint64_t lo = strtoull(prefix.c_str(), nullptr, 16) << bits;
+    uint64_t hi = bits ? lo | ((uint64_t(1) << bits) - 1) : lo;
+    int64_t found = 0;
+    auto match = [&](uint64_t id) { found = found ? -1 : int64_t(id); };
+    size_t l = 0, r = hashed;
+    while (l < r) {
+        size_t m = (l + r) / 2;
+        if (read64(hashEntry(m)) < lo) l = m + 1;
+        else r = m;
+    }
+    for (; l < hashed && read64(hashEntry(l)) <= hi && found >= 0; ++l) match(read64(hashEntry(l) + 8));
+    for (auto it = lower_bound(unfiled.begin(), unfiled.end(), make_pair(lo, uint64_t(0)));
+         it != unfiled.end() && it->first <= hi && found >= 0; ++it) match(it->second);
+    // Records of a batch not yet on disk.
+    Record rec;
+    string message;
+    for (size_t id = persistedCount + 1; id <= count && found >= 0; ++id) {
+        if (!read(id, rec, message)) break;
+        uint64_t h = hashOf(rec, message);
+        if (h >= lo && h <= hi) match(id);
+    }
+    return found;
+}
+
+string CommitLog::digest(size_t n) const {
+    ContentHash::Stream s;
+    Record r;
+    string message;
+    for (size_t back = 0; back < n; back = back ? back * 2 : 1) {
+        if (!read(n - back, r, message)) return "";
+        s.update(to_string(n - back) + " " + to_string(r.parent) + " " + to_string(r.timestamp) + " " + r.tree + " "
+                 + to_string(message.size()) + "\n");
+        s.update(message);
+    }
+    return ContentHash::hex(s.digest());
+}
+
+bool CommitLog::append(Record& r, const string& message) {
+    r.messageOffset = messagesSize;
+    r.messageLength = uint32_t(message.size());
+    string rec = encode(r);
+    if (batching) {
+        pendingMessages += message;
+        pendingRecords += rec;
+    } else {
+        if (!writeAppend(message, rec)) return false;
+        persistedCount = count + 1;
+        persistedMessagesSize = messagesSize + message.size();
+    }
+    messagesSize += message.size();
+    ++count;
+    return true;
+}
+
+bool CommitLog::commitBatch() {
+    batching = false;
+    if (pendingRecords.empty()) return true;
+    if (!writeAppend(pendingMessages, pendingRecords)) { abortBatch(); return false; }
+    persistedCount = count;
+    persistedMessagesSize = messagesSize;
+    pendingMessages.clear();
+    pendingRecords.clear();
+    return true;
+}
+
+void CommitLog::abortBatch() {
+    batching = false;
+    count = persistedCount;
+    messagesSize = persistedMessagesSize;
+    pendingMessages.clear();
+    pendingRecords.clear();
+}
+
+int64_t StatCache::nowNanos() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+bool StatCache::statFile(const string& file, Entry& e) {
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+#ifdef __APPLE__
+    e.mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    e.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    e.size = uint64_t(st.st_size);
+    e.inode = uint64_t(st.st_ino);
+#else
+    error_code ec;
+    e.size = fs::file_size(file, ec);
+    if (ec) return false;
+    e.mtime = chrono::duration_cast<chrono::nanoseconds>(fs::last_write_time(file, ec).time_since_epoch()).count();
+    e.inode = 0;
+#endif
+    return true;
+}
+
+bool StatCache::read(const string& path, unordered_map<string, Entry>& out) {
+    ifstream in(path, ios::binary);
+    if (!in) return true;
+    char magic[8];
+    uint64_t n = 0;
+    if (!in.read(magic, 8) || memcmp(magic, MAGIC, 8) != 0 || !in.read(reinterpret_cast<char*>(&n), 8)) return false;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint32_t len;
+        if (!in.read(reinterpret_cast<char*>(&len), 4)) return false;
+        string name(len, '\0');
+        Entry e;
+        e.hash.assign(16, '\0');
+        if (!in.read(&name[0], len) || !in.read(reinterpret_cast<char*>(&e.mtime), 8)
+            || !in.read(reinterpret_cast<char*>(&e.size), 8) || !in.read(reinterpret_cast<char*>(&e.inode), 8)
+            || !in.read(&e.hash[0], 16))
+            return false;
+        out[name] = e;
+    }
+    return true;
+}
+
+void StatCache::merge() {
+    Entry now;
+    if (!statFile(path, now) || (now.mtime == stamp.mtime && now.size == stamp.size && now.inode == stamp.inode)) return;
+    unordered_map<string, Entry> disk;
+    if (!read(path, disk)) return;
+    for (const string& name : touched) {
+        auto it = entries.find(name);
+        if (it == entries.end()) disk.erase(name);
+        else disk[name] = it->second;
+    }
+    entries.swap(disk);
+    stamp = now;
+}
+
+bool StatCache::load(const string& p) {
+    path = p;
+    entries.clear();
+    touched.clear();
+    dirty = false;
+    stamp = Entry();
+    statFile(path, stamp);
+    return read(path, entries);
+}
+
+bool StatCache::save() {
+    if (!dirty) return true;
+    merge();
+    int64_t racyAfter = nowNanos() - 2000000000LL;
+#ifndef _WIN32
+    string tmp = path + ".tmp" + to_string(getpid());  // any process may save it
+#else
+    string tmp = path + ".tmp";
+#endif
+    ofstream out(tmp, ios::binary);
+    uint64_t n = entries.size();
+    out.write(MAGIC, 8);
+    out.write(reinterpret_cast<const char*>(&n), 8);
+    for (const auto& p : entries) {
+        uint32_t len = uint32_t(p.first.size());
+        uint64_t size = p.second.mtime >= racyAfter ? SMUDGED : p.second.size;
+        out.write(reinterpret_cast<const char*>(&len), 4);
+        out.write(p.first.data(), len);
+        out.write(reinterpret_cast<const char*>(&p.second.mtime), 8);
+        out.write(reinterpret_cast<const char*>(&size), 8);
+        out.write(reinterpret_cast<const char*>(&p.second.inode), 8);
+        out.write(p.second.hash.data(), 16);
+    }
+    out.close();
+    error_code ec;
+    if (!out) { fs::remove(tmp, ec); return false; }
+    fs::rename(tmp, path, ec);
+    if (ec) return false;
+    statFile(path, stamp);
+    touched.clear();
+    dirty = false;
+    return true;
+}
+
+const StatCache::Entry* StatCache::find(const string& file) const {
+    auto it = entries.find(file);
+    return it == entries.end() ? nullptr : &it->second;
+}
+
+bool StatCache::isUnchanged(const string& file, const Entry& now) const {
+    const Entry* e = find(file);
+    return e && e->mtime == now.mtime && e->size == now.size && e->inode == now.inode;
+}
+
+void StatCache::record(const string& file, const Entry& now, const string& hash) {
+    Entry& e = entries[file];
+    e = now;
+    e.hash = hash;
+    touched.insert(file);
+    dirty = true;
+}
+
+void StatCache::refresh(const string& file, const string& hash) {
+    Entry now;
+    if (statFile(file, now)) record(file, now, hash);
+}
+
+void StatCache::erase(const string& file) {
+    if (entries.erase(file) == 0) return;
+    touched.insert(file);
+    dirty = true;
+}
+
+vector<string> StatCache::paths() const {
+    vector<string> out;
+    out.reserve(entries.size());
+    for (const auto& p : entries) out.push_back(p.first);
+    return out;
+}
+
+bool Refs::writeAtomic(const string& path, const string& text) {
+    string tmp = path + ".tmp";
+    if (!File::writeBytes(tmp, text)) return false;
+    error_code ec;
+    fs::rename(tmp, path, ec);
+    return !ec;
+}
+
+bool Refs::flush() {
+    if (batching) return true;
+    error_code ec;
+    fs::create_directories(root + "/refs/heads", ec);
+    for (const auto& t : tips) {
+        if (!writeAtomic(root + "/refs/heads/" + t.first, to_string(t.second) + "\n")) return false;
+    }
+    return writeAtomic(root + "/HEAD", current.empty() ? to_string(detachedAt) + "\n" : "ref: " + current + "\n");
+}
+
+bool Refs::validName(const string& name) {
+    return !name.empty() && name.size() < 128 && !all_of(name.begin(), name.end(), ::isdigit)
+        && name[0] != '-' && name[0] != '.'
+        && all_of(name.begin(), name.end(), [](char c) { return isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.'; });
+}
+
+bool Refs::open(const string& dir, int latest) {
+    root = dir;
+    tips.clear();
+    error_code ec;
+    for (fs::directory_iterator it(root + "/refs/heads", ec), end; !ec && it != end; it.increment(ec)) {
+        string name = it->path().filename().string();
+        ifstream in(it->path());
+        int id;
+        if (validName(name) && in >> id) tips[name] = id;
+    }
+    ifstream head(root + "/HEAD");
+    string line;
+    current = "main";
+    detachedAt = 0;
+    if (head && getline(head, line)) {
+        if (line.rfind("ref: ", 0) == 0) current = line.substr(5);
+        else { current.clear(); detachedAt = atoi(line.c_str()); }
+        return true;
+    }
+    if (latest > 0 && !tips.count("main")) tips["main"] = latest;
+    return latest == 0 || flush();
+}
+
+int Refs::head() const {
+    if (current.empty()) return detachedAt;
+    auto it = tips.find(current);
+    return it == tips.end() ? 0 : it->second;
+}
+
+int Refs::tip(const string& name) const {
+    auto it = tips.find(name);
+    return it == tips.end() ? -1 : it->second;
+}
+
+bool Refs::createBranch(const string& name, int id) {
+    tips[name] = id;
+    return flush();
+}
+
+bool Refs::advance(int id) {
+    if (current.empty()) detachedAt = id;
+    else tips[current] = id;
+    return flush();
+}
+
+bool Refs::switchTo(const string& name, int id) {
+    current = name;
+    tips[name] = id;
+    return flush();
+}
+
+bool Refs::detach(int id) {
+    current.clear();
+    detachedAt = id;
+    return flush();
+}
+
+bool Refs::commitBatch() {
+    batching = false;
+    return flush();
+}
+
+void Refs::abortBatch() {
+    batching = false;
+    open(root, 0);
+}
+
+string Journal::serialize() const {
+    ostringstream out;
+    out << "VCSJRNL1\n" << record.id << ' ' << record.parent << ' ' << record.timestamp << ' ' << record.tree << '\n'
+        << (branch.empty() ? "-" : branch) << '\n' << message.size() << '\n' << message << '\n' << files.size() << '\n';
+    for (const Entry& e : files) out << e.blob << ' ' << ContentHash::hex(e.hash) << ' ' << e.path << '\n';
+    string body = out.str();
+    return body + ContentHash::hex(ContentHash::of(body)) + '\n';
+}
+
+bool Journal::parse(const string& text) {
+    if (text.size() < 17 || text.back() != '\n') return false;
+    string body = text.substr(0, text.size() - 17);
+    if (ContentHash::hex(ContentHash::of(body)) != text.substr(body.size(), 16)) return false;
+    istringstream in(body);
+    string magic, line;
+    size_t length = 0, n = 0;
+    if (!getline(in, magic) || magic != "VCSJRNL1") return false;
+    if (!(in >> record.id >> record.parent >> record.timestamp >> record.tree >> branch >> length) || in.get() != '\n')
+        return false;
+    if (branch == "-") branch.clear();
+    message.assign(length, '\0');
+    if (!in.read(&message[0], length) || in.get() != '\n' || !(in >> n) || in.get() != '\n') return false;
+    files.clear();
+    while (files.size() < n && getline(in, line)) {
+        if (line.size() < 35 || line[16] != ' ' || line[33] != ' ') return false;
+        files.push_back(Entry{line.substr(34), line.substr(0, 16), PackFile::parseHash(line.substr(17, 16))});
+    }
+    return files.size() == n;
+}
+
+bool Journal::read(const string& path) {
+    ifstream in(path, ios::binary);
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    return in && parse(text);
+}
+
+bool TreeEntry::resolveKind(const ObjectStore& store, Kind& out, string* read) const {
+    out = kind.value.load(memory_order_relaxed);
+    if (out == UNKNOWN) {
+        char stored;
+        string base, data;
+        if (!store.peek(blob(), stored, base) || (stored != 'C' && !store.get(blob(), data))) return false;
+        out = stored == 'C' || File::looksBinary(data) ? BINARY : TEXT;
+        kind.value.store(out, memory_order_relaxed);
+        if (read) *read = move(data);
+    }
+    return true;
+}
+
+bool TreeEntry::contentIn(const ObjectStore& store, string& out) const {
+    if (!content) return store.get(blob(), out);
+    out = *content;
+    return true;
+}
+
+shared_ptr<const TreeNode> Tree::apply(const shared_ptr<const TreeNode>& old, vector<TreeEntry>::iterator& it,
+                                       vector<TreeEntry>::iterator end, const string& dir) {
+    auto n = make_shared<TreeNode>();
+    static const vector<TreeEntry> none;
+    const vector<TreeEntry>& files = old ? old->files : none;
+    if (old) n->dirs = old->dirs;
+    bool changed = !old;
+    auto kept = files.begin();
+    while (it != end && it->path.compare(0, dir.size(), dir) == 0) {
+        size_t slash = it->path.find('/', dir.size());
+        if (slash == string::npos) {
+            for (; kept != files.end() && kept->path < it->path; ++kept) n->files.push_back(*kept);
+            bool replaces = kept != files.end() && kept->path == it->path;
+            if (replaces && kept->hash == it->hash) n->files.push_back(*kept);
+            else { n->files.push_back(move(*it)); changed = true; }
+            if (replaces) ++kept;
+            ++it;
+            continue;
+        }
+        string name = it->path.substr(dir.size(), slash + 1 - dir.size());
+        auto d = n->dirs.find(name);
+        shared_ptr<const TreeNode> sub = apply(d != n->dirs.end() ? d->second : nullptr, it, end, dir + name);
+        if (d == n->dirs.end() || sub != d->second) { n->dirs[name] = move(sub); changed = true; }
+    }
+    if (!changed) return old;
+    n->files.insert(n->files.end(), kept, files.end());
+    n->count = n->files.size();
+    for (const auto& d : n->dirs) n->count += d.second->count;
+    return n;
+}
+
+const TreeEntry* Tree::lookup(const string& path) const {
+    const TreeNode* n = root.get();
+    for (size_t pos = 0; n;) {
+        size_t slash = path.find('/', pos);
+        if (slash == string::npos) {
+            auto it = lower_bound(n->files.begin(), n->files.end(), path, [](const TreeEntry& e, const string& p) { return e.path < p; });
+            return it != n->files.end() && it->path == path ? &*it : nullptr;
+        }
+        auto d = n->dirs.find(string_view(path).substr(pos, slash + 1 - pos));
+        n = d != n->dirs.end() ? d->second.get() : nullptr;
+        pos = slash + 1;
+    }
+    return nullptr;
+}
+
+Tree Tree::with(vector<TreeEntry> edits) const {
+    auto it = edits.begin();
+    shared_ptr<const TreeNode> r = apply(root, it, edits.end(), "");
+    return Tree(r ? move(r) : make_shared<TreeNode>());
+}
+
+Commit::Commit(const CommitLog::Record& r, const string& msg, Tree e)
+    : id(int(r.id)), parent(int(r.parent)), message(msg), timestamp(time_t(r.timestamp)), tree(r.tree),
+      hash(ContentHash::hex(CommitLog::hashOf(r, msg))), entries(move(e)) {}
+
+bool Commit::parseTree(const string& text, map<string, string>& blobs) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == string::npos || nl < pos + 18 || text[pos + 16] != ' ') return false;
+        blobs[text.substr(pos + 17, nl - pos - 17)] = text.substr(pos, 16);
+        pos = nl + 1;
+    }
+    return true;
+}
+
+string Commit::getTimestamp() const {
+    tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &timestamp);
+#else
+    localtime_r(&timestamp, &local);
+#endif
+    char ts[32];
+    return strftime(ts, sizeof ts, "%a %b %e %H:%M:%S %Y", &local) ? ts : "";
+}
+
+void Commit::showDetails(ostream& os, const Commit* parentCommit, const ObjectStore& store) const {
+    os << "Commit " << id << ": " << message << " at " << getTimestamp() << '\n' << "Hash: " << hash << '\n';
+    string data;
+    Tree::compare(parentCommit ? parentCommit->entries : Tree(), entries, [&](const TreeEntry*, const TreeEntry* e) {
+        if (!e) return;
+        TreeEntry::Kind kind;
+        data.clear();
+        if (e->resolveKind(store, kind, &data) && kind == TreeEntry::BINARY) {
+            BinaryFile::show(os, e->path);
+            return;
+        }
+        if (data.empty() && !e->contentIn(store, data)) cout << "Warning: content of " << e->path << " is unavailable." << endl;
+        TextFile::show(os, e->path, data);
+    });
+}
+
+bool IgnoreRules::globMatch(const char* pattern, const char* name) {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*name) {
+        if (*pattern == '?' || *pattern == *name) { ++pattern; ++name; }
+        else if (*pattern == '*') { star = pattern++; resume = name; }
+        else if (star) { pattern = star + 1; name = ++resume; }
+        else return false;
+    }
+    while (*pattern == '*') ++pattern;
+    return !*pattern;
+}
+
+void IgnoreRules::load(const string& path) {
+    rules.clear();
+    ifstream in(path);
+    string line;
+    while (getline(in, line)) {
+        while (!line.empty() && isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        Rule r;
+        r.dirOnly = line.back() == '/';
+        if (r.dirOnly) line.pop_back();
+        r.wholePath = line.find('/') != string::npos;
+        if (line[0] == '/') line.erase(0, 1);
+        if (line.empty()) continue;
+        r.pattern = move(line);
+        rules.push_back(move(r));
+    }
+}
+
+bool IgnoreRules::ignored(const string& path, const string& name, bool isDir) const {
+    if (path == ".vcs" || (!isDir && name.size() > 8 && name.compare(name.size() - 8, 8, ".vcs-new") == 0)) return true;
+    for (const Rule& r : rules) {
+        if (r.dirOnly && !isDir) continue;
+        if (globMatch(r.pattern.c_str(), r.wholePath ? path.c_str() : name.c_str())) return true;
+    }
+    return false;
+}
@@ -1,275 +1,718 @@
-#include <iostream>
-#include <vector>
-#include <map>
-#include <string>
-#include <ctime>
-#include <memory>
-#include <fstream>
-#include <algorithm>
-#include <filesystem>
-
-namespace fs = std::filesystem;
-using namespace std;
-
-class File {
-protected:
-    string name;
-    string content;
-    string stagedContent;
-    bool modified;
-public:
-    File(const string& n, const string& c = "") 
-        : name(n), content(c), stagedContent(c), modified(false) {}
-
-    virtual ~File() {}
-
-    virtual void showContent() const = 0;
-    virtual File* clone() const = 0;
-
-    void updateContent(const string& c) { 
-        stagedContent = c; 
-        modified = true;   
-    }
-
-    string getContent() const { return content; }
-    string getStagedContent() const { return stagedContent; }
-    string getName() const { return name; }
-
-    bool isModified() const { return modified; }
-    void clearModified() { 
-        modified = false; 
-        content = stagedContent;
-    }
-
-    virtual void saveToDisk() const {
-        ofstream out(name);
-        out << content;
-        out.close();
-    }
-
-    static File* loadFromDisk(const string& fname);
-};
-
-class TextFile : public File {
-public:
-    TextFile(const string& n, const string& c = "") : File(n, c) {}
-    void showContent() const override {
-        cout << "[TextFile] " << name << ": " << stagedContent << endl;
-    }
-    File* clone() const override { return new TextFile(*this); }
-};
-
-File* File::loadFromDisk(const string& fname) {
-    if (!fs::exists(fname)) return nullptr;
-    ifstream in(fname);
-    string content, line;
-    while (getline(in, line)) content += line + "\n";
-    in.close();
-    return new TextFile(fname, content);
-}
-
-class Commit {
-    int id;
-    string message;
-    string timestamp;
-    map<string, unique_ptr<File>> files;
-public:
-    Commit(int i, const string& msg, const vector<File*>& staged) : id(i), message(msg) {
-        time_t now = time(nullptr);
-        timestamp = ctime(&now);
-        if (!timestamp.empty() && timestamp.back() == '\n') timestamp.pop_back();
-
-        for (File* f : staged) files[f->getName()] = unique_ptr<File>(f->clone());
-    }
-
-    void showDetails() const {
-        cout << "Commit " << id << ": " << message << " at " << timestamp << endl;
-        for (const auto& p : files) p.second->showContent();
-    }
-
-    map<string, File*> getSnapshot() const {
-        map<string, File*> snapshot;
-        for (const auto& p : files) snapshot[p.first] = p.second->clone();
-        return snapshot;
-    }
-
-    int getId() const { return id; }
-};
-
-class Repository {
-    vector<unique_ptr<Commit>> commits;
-    vector<File*> stagedFiles;
-    int nextCommitId;
-
-    Repository() : nextCommitId(1) { 
-        fs::create_directory(".vcs"); 
-    }
-
-public:
-    static Repository& getInstance() {
-        static Repository instance;
-        return instance;
-    }
-
-    void addFile(File* f) {
-        if (find(stagedFiles.begin(), stagedFiles.end(), f) == stagedFiles.end()) {
-            stagedFiles.push_back(f);
-            cout << "Added file to staging: " << f->getName() << endl;
-        }
-    }
-
-    void commit(const string& msg) {
-        vector<File*> editableFiles;
-        for (File* f : stagedFiles) {
-            if (f->isModified()) editableFiles.push_back(f);
-        }
-
-        if (editableFiles.empty()) {
-            cout << "No edited files to commit! Edit files first." << endl;
-            return;
-        }
-
-        string commitPath = ".vcs/commit_" + to_string(nextCommitId);
-        fs::create_directory(commitPath);
-
-        for (File* f : editableFiles) {
-            string filePath = commitPath + "/" + f->getName();
-            ofstream out(filePath);
-            out << f->getStagedContent();
-            out.close();
-
-            f->clearModified();
-            f->saveToDisk();
-        }
-
-        commits.push_back(make_unique<Commit>(nextCommitId++, msg, editableFiles));
-
-        for (File* f : editableFiles) {
-            stagedFiles.erase(remove(stagedFiles.begin(), stagedFiles.end(), f), stagedFiles.end());
-        }
-
-        cout << "Commit done! Changes saved to .vcs and original files updated." << endl;
-    }
-
-    void log() const {
-        if (commits.empty()) { 
-            cout << "No commits yet." << endl; 
-            return; 
-        }
-        for (const auto& c : commits) {
-            c->showDetails();
-            cout << "--------------------" << endl;
-        }
-    }
-
-    void checkout(int commitId, vector<File*>& workingFiles) {
-        for (const auto& c : commits) {
-            if (c->getId() == commitId) {
-                map<string, File*> snapshot = c->getSnapshot();
-                workingFiles.clear();
-                for (auto& p : snapshot) {
-                    workingFiles.push_back(p.second);
-                    ofstream out(p.second->getName());
-                    out << p.second->getContent();
-                    out.close();
-                }
-                cout << "Checked out commit " << commitId << ", files restored on disk." << endl;
-                return;
-            }
-        }
-        cout << "Commit ID not found!" << endl;
-    }
-
-    void cleanup() {
-        if (fs::exists(".vcs")) fs::remove_all(".vcs");
-    }
-
-    friend class VCS;
-};
-
-class VCS {
-    vector<File*> workingFiles;
-    Repository& repo;
-public:
-    VCS() : repo(Repository::getInstance()) {}
-
-    void runCommand(const string& cmd) {
-        if (cmd.rfind("add ", 0) == 0) {
-            string fname = cmd.substr(4);
-            File* f = File::loadFromDisk(fname);
-            if (!f) {
-                cout << "File does not exist on disk. Create new? (y/n): ";
-                char ch; cin >> ch; cin.ignore();
-                if (ch == 'y' || ch == 'Y') {
-                    f = new TextFile(fname);
-                    ofstream out(fname); out.close();
-                    cout << "File created." << endl;
-                    cout << "Do you want to edit now? (y/n): ";
-                    cin >> ch; cin.ignore();
-                    if (ch == 'y' || ch == 'Y') editFile(f);
-                } else return;
-            }
-
-            if (find(workingFiles.begin(), workingFiles.end(), f) == workingFiles.end())
-                workingFiles.push_back(f);
-
-            repo.addFile(f);
-        } 
-        else if (cmd.rfind("edit ", 0) == 0) {
-            string fname = cmd.substr(5);
-            for (File* f : workingFiles) {
-                if (f->getName() == fname) { 
-                    editFile(f); 
-                    return; 
-                }
-            }
-            cout << "File not found in working directory!" << endl;
-        } 
-        else if (cmd.rfind("commit ", 0) == 0) {
-            string msg = cmd.substr(7);
-            repo.commit(msg);
-        } 
-        else if (cmd == "log") {
-            repo.log();
-        } 
-        else if (cmd.rfind("checkout ", 0) == 0) {
-            int id = stoi(cmd.substr(9));
-            repo.checkout(id, workingFiles);
-        } 
-        else {
-            cout << "Unknown command!" << endl;
-        }
-    }
-
-    void editFile(File* f) {
-        cout << "Enter new content for " << f->getName() << ": ";
-        string newContent;
-        getline(cin, newContent);
-        f->updateContent(newContent);
-
-        cout << f->getName() << " updated in memory (not saved to disk)." << endl;
-        cout << "Note: Changes are staged. Use 'commit <msg>' to save these changes permanently." << endl;
-
-        repo.addFile(f);
-    }
-
-    void showWorkingFiles() {
-        cout << "Current Working Files:" << endl;
-        for (File* f : workingFiles) f->showContent();
-    }
-
-    ~VCS() { repo.cleanup(); }
-};
-
-int main() {
-    VCS vcs;
-    string cmd;
-    cout << "Mini VCS running. Commands: add <file>, edit <file>, commit <msg>, log, checkout <id>, exit" << endl;
-    while (true) {
-        cout << ">> ";
-        getline(cin, cmd);
-        if (cmd == "exit") break;
-        vcs.runCommand(cmd);
-    }
-    return 0;
-}
+#include "Vcs_oops.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define VCSIM_HAVE_AVX2_KERNEL 1
+#endif
+
+using namespace std;
+
+const char* Stats::name(Metric m) {
+    static const char* names[METRIC_COUNT] = {
+        "file.load", "file.write", "hash", "object.delta", "object.chunk", "object.compress", "object.decompress",
+        "object.read", "object.write", "fs.sync", "commit", "commit.store", "commit.write_files",
+        "commit.record", "checkout", "log", "gc"};
+    return names[m];
+}
+
+Stats& Stats::get() {
+    static Stats instance;
+    return instance;
+}
+
+void Stats::add(Metric m, uint64_t ns) {
+    counters[m].calls.fetch_add(1, memory_order_relaxed);
+    counters[m].ns.fetch_add(ns, memory_order_relaxed);
+    uint64_t prev = counters[m].maxNs.load(memory_order_relaxed);
+    while (ns > prev && !counters[m].maxNs.compare_exchange_weak(prev, ns, memory_order_relaxed)) {}
+}
+
+void Stats::reset() {
+    for (auto& c : counters) c.calls = c.ns = c.maxNs = c.bytes = 0;
+    lock_guard<mutex> lock(traceMutex);
+    events.clear();
+}
+
+void Stats::report(ostream& os) const {
+    ostringstream out;
+    out << left << setw(20) << "metric" << right << setw(10) << "calls" << setw(12) << "total ms"
+        << setw(11) << "avg us" << setw(11) << "max us" << setw(11) << "MB" << setw(10) << "MB/s" << '\n';
+    double cpu = 0, io = 0;
+    for (int i = 0; i < METRIC_COUNT; ++i) {
+        const Counter& c = counters[i];
+        uint64_t calls = c.calls, ns = c.ns, bytes = c.bytes;
+        if (!calls) continue;
+        double ms = ns / 1e6, mb = bytes / 1e6;
+        if (isCpu(Metric(i))) cpu += ms;
+        if (isIo(Metric(i))) io += ms;
+        out << left << setw(20) << name(Metric(i)) << right << setw(10) << calls << fixed << setprecision(3)
+            << setw(12) << ms << setprecision(1) << setw(11) << ns / 1e3 / calls << setw(11) << c.maxNs / 1e3
+            << setprecision(2) << setw(11) << mb << setprecision(1) << setw(10) << (ns ? mb / (ns / 1e9) : 0.0) << '\n';
+    }
+    out << fixed << setprecision(3) << "cpu (hash, delta, chunk, compress, decompress): " << cpu << " ms\n"
+        << "i/o (file and object reads and writes, syncs): " << io << " ms\n";
+    os << out.str() << flush;
+}
+
+void Stats::writeJson(ostream& os) const {
+    os << "{";
+    bool first = true;
+    for (int i = 0; i < METRIC_COUNT; ++i) {
+        const Counter& c = counters[i];
+        if (!c.calls) continue;
+        os << (first ? "" : ",") << "\n  \"" << name(Metric(i)) << "\": {\"calls\": " << c.calls
+           << ", \"ns\": " << c.ns << ", \"max_ns\": " << c.maxNs << ", \"bytes\": " << c.bytes << "}";
+        first = false;
+    }
+    os << "\n}" << endl;
+}
+
+bool Stats::writeTrace(const string& path) const {
+    lock_guard<mutex> lock(traceMutex);
+    ofstream out(path);
+    out << "{\"traceEvents\": [";
+    for (size_t i = 0; i < events.size(); ++i) {
+        const Event& e = events[i];
+        out << (i ? ",\n" : "\n") << "{\"name\": \"" << name(e.metric) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+            << e.thread << ", \"ts\": " << e.startUs << ", \"dur\": " << e.durUs << "}";
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+Stats::Stats() {
+    if (const char* p = getenv("VCSIM_TRACE")) tracePath = p;
+}
+
+Stats::~Stats() {
+    if (tracing()) writeTrace(tracePath);
+}
+
+unsigned Stats::threadNumber() {
+    static atomic<unsigned> next(0);
+    thread_local unsigned number = next++;
+    return number;
+}
+
+void Stats::finish(Metric m, chrono::steady_clock::time_point start, chrono::steady_clock::time_point end) {
+    add(m, uint64_t(chrono::duration_cast<chrono::nanoseconds>(end - start).count()));
+    if (!tracing()) return;
+    lock_guard<mutex> lock(traceMutex);
+    if (events.size() < MAX_EVENTS) {
+        events.push_back(Event{m, threadNumber(), chrono::duration<double, micro>(start - epoch).count(),
+                               chrono::duration<double, micro>(end - start).count()});
+    }
+}
+
+const char* ContentHash::stripes(uint64_t v[4], const char* p, const char* end) {
+    for (; p + 32 <= end; p += 32) {
+        v[0] = round(v[0], read64(p));
+        v[1] = round(v[1], read64(p + 8));
+        v[2] = round(v[2], read64(p + 16));
+        v[3] = round(v[3], read64(p + 24));
+    }
+    return p;
+}
+
+uint64_t ContentHash::converge(const uint64_t v[4]) {
+    uint64_t h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    h = merge(h, v[0]); h = merge(h, v[1]); h = merge(h, v[2]); h = merge(h, v[3]);
+    return h;
+}
+
+uint64_t ContentHash::finish(uint64_t h, uint64_t len, const char* p, const char* end) {
+    h += len;
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) { h = rotl(h ^ (uint64_t(read32(p)) * P1), 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) h = rotl(h ^ (uint64_t(uint8_t(*p)) * P5), 11) * P1;
+    h ^= h >> 33; h *= P2;
+    h ^= h >> 29; h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t ContentHash::of(string_view data) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint64_t h = P5;
+    if (data.size() >= 32) {
+        uint64_t v[4] = {P1 + P2, P2, 0, 0 - P1};
+        p = stripes(v, p, end);
+        h = converge(v);
+    }
+    return finish(h, data.size(), p, end);
+}
+
+void ContentHash::Stream::update(string_view data) {
+    const char* p = data.data();
+    const char* end = p + data.size();
+    total += data.size();
+    if (buffered) {
+        size_t take = min(size_t(end - p), 32 - buffered);
+        memcpy(pending + buffered, p, take);
+        buffered += take;
+        p += take;
+        if (buffered < 32) return;
+        stripes(v, pending, pending + 32);
+        buffered = 0;
+    }
+    p = stripes(v, p, end);
+    memcpy(pending, p, size_t(end - p));
+    buffered = size_t(end - p);
+}
+
+uint64_t ContentHash::Stream::digest() const {
+    return finish(total >= 32 ? converge(v) : P5, total, pending, pending + buffered);
+}
+
+string ContentHash::hex(uint64_t h) {
+    static const char* digits = "0123456789abcdef";
+    string out(16, '0');
+    for (int i = 15; i >= 0; --i, h >>= 4) out[i] = digits[h & 0xf];
+    return out;
+}
+
+// XXH3-64 as the reference implementation computes it, with its default
+// secret and seed 0.
+namespace {
+const uint8_t XXH3_SECRET[192] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+const char* const SECRET = reinterpret_cast<const char*>(XXH3_SECRET);
+const size_t STRIPE = 64, STRIPES_PER_BLOCK = (sizeof XXH3_SECRET - STRIPE) / 8, BLOCK = STRIPE * STRIPES_PER_BLOCK;
+
+const uint64_t P32_1 = 0x9E3779B1U, P32_2 = 0x85EBCA77U, P32_3 = 0xC2B2AE3DU;
+const uint64_t P64_1 = 0x9E3779B185EBCA87ULL, P64_2 = 0xC2B2AE3D27D4EB4FULL, P64_3 = 0x165667B19E3779F9ULL,
+               P64_4 = 0x85EBCA77C2B2AE63ULL, P64_5 = 0x27D4EB2F165667C5ULL;
+const uint64_t MX1 = 0x165667919E3779F9ULL, MX2 = 0x9FB21C651E98DF25ULL;
+
+uint64_t read64(const char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+uint32_t read32(const char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+uint64_t swap64(uint64_t x) { return __builtin_bswap64(x); }
+
+uint64_t fold64(uint64_t a, uint64_t b) {
+    unsigned __int128 p = (unsigned __int128)a * b;
+    return uint64_t(p) ^ uint64_t(p >> 64);
+}
+
+uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= MX1;
+    return h ^ (h >> 32);
+}
+
+uint64_t avalanche64(uint64_t h) {
+    h ^= h >> 33; h *= P64_2;
+    h ^= h >> 29; h *= P64_3;
+    return h ^ (h >> 32);
+}
+
+uint64_t mix16(const char* p, const char* secret) {
+    return fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+uint64_t upTo16(const char* p, size_t len) {
+    if (len > 8) {
+        uint64_t lo = read64(p) ^ (read64(SECRET + 24) ^ read64(SECRET + 32));
+        uint64_t hi = read64(p + len - 8) ^ (read64(SECRET + 40) ^ read64(SECRET + 48));
+        return avalanche(len + swap64(lo) + hi + fold64(lo, hi));
+    }
+    if (len >= 4) {
+        uint64_t in = read32(p + len - 4) + (uint64_t(read32(p)) << 32);
+        uint64_t h = in ^ (read64(SECRET + 8) ^ read64(SECRET + 16));
+        h ^= rotl(h, 49) ^ rotl(h, 24);
+        h *= MX2;
+        h ^= (h >> 35) + len;
+        h *= MX2;
+        return h ^ (h >> 28);
+    }
+    if (len > 0) {
+        uint32_t combined = uint32_t(uint8_t(p[0])) << 16 | uint32_t(uint8_t(p[len >> 1])) << 24 | uint32_t(uint8_t(p[len - 1]))
+                            | uint32_t(len) << 8;
+        return avalanche64(combined ^ uint64_t(read32(SECRET) ^ read32(SECRET + 4)));
+    }
+    return avalanche64(read64(SECRET + 56) ^ read64(SECRET + 64));
+}
+
+uint64_t upTo128(const char* p, size_t len) {
+    uint64_t acc = len * P64_1;
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) acc += mix16(p + 48, SECRET + 96) + mix16(p + len - 64, SECRET + 112);
+            acc += mix16(p + 32, SECRET + 64) + mix16(p + len - 48, SECRET + 80);
+        }
+        acc += mix16(p + 16, SECRET + 32) + mix16(p + len - 32, SECRET + 48);
+    }
+    acc += mix16(p, SECRET) + mix16(p + len - 16, SECRET + 16);
+    return avalanche(acc);
+}
+
+uint64_t upTo240(const char* p, size_t len) {
+    uint64_t acc = len * P64_1;
+    for (size_t i = 0; i < 8; ++i) acc += mix16(p + 16 * i, SECRET + 16 * i);
+    acc = avalanche(acc);
+    for (size_t i = 8; i < len / 16; ++i) acc += mix16(p + 16 * i, SECRET + 16 * (i - 8) + 3);
+    acc += mix16(p + len - 16, SECRET + 136 - 17);
+    return avalanche(acc);
+}
+
+// The long-input loop: every 64-byte stripe feeds eight accumulators, and
+// after each block of 16 stripes they are scrambled.
+void accumulateScalar(uint64_t acc[8], const char* p, const char* secret) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t data = read64(p + 8 * i);
+        uint64_t key = data ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data;
+        acc[i] += (key & 0xFFFFFFFFU) * (key >> 32);
+    }
+}
+
+void scrambleScalar(uint64_t acc[8], const char* secret) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * P32_1;
+    }
+}
+
+void stripesScalar(uint64_t acc[8], const char* p, size_t len) {
+    size_t blocks = (len - 1) / BLOCK;
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) accumulateScalar(acc, p + b * BLOCK + s * STRIPE, SECRET + s * 8);
+        scrambleScalar(acc, SECRET + sizeof XXH3_SECRET - STRIPE);
+    }
+    size_t last = ((len - 1) - blocks * BLOCK) / STRIPE;
+    for (size_t s = 0; s < last; ++s) accumulateScalar(acc, p + blocks * BLOCK + s * STRIPE, SECRET + s * 8);
+    accumulateScalar(acc, p + len - STRIPE, SECRET + sizeof XXH3_SECRET - STRIPE - 7);
+}
+
+#ifdef VCSIM_HAVE_AVX2_KERNEL
+// The same loop, 32 bytes of a stripe (four accumulators) per instruction.
+__attribute__((target("avx2"))) void accumulateAvx2(__m256i acc[2], const char* p, const char* secret) {
+    for (int i = 0; i < 2; ++i) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+        __m256i key = _mm256_xor_si256(data, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret + 32 * i)));
+        __m256i product = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        acc[i] = _mm256_add_epi64(acc[i], _mm256_add_epi64(product, swapped));
+    }
+}
+
+__attribute__((target("avx2"))) void scrambleAvx2(__m256i acc[2], const char* secret) {
+    const __m256i prime = _mm256_set1_epi32(int(P32_1));
+    for (int i = 0; i < 2; ++i) {
+        __m256i a = _mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret + 32 * i)));
+        __m256i lo = _mm256_mul_epu32(a, prime);
+        __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+        acc[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+    }
+}
+
+__attribute__((target("avx2"))) void stripesAvx2(uint64_t out[8], const char* p, size_t len) {
+    __m256i acc[2] = {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(out)),
+                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out + 4))};
+    size_t blocks = (len - 1) / BLOCK;
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; ++s) accumulateAvx2(acc, p + b * BLOCK + s * STRIPE, SECRET + s * 8);
+        scrambleAvx2(acc, SECRET + sizeof XXH3_SECRET - STRIPE);
+    }
+    size_t last = ((len - 1) - blocks * BLOCK) / STRIPE;
+    for (size_t s = 0; s < last; ++s) accumulateAvx2(acc, p + blocks * BLOCK + s * STRIPE, SECRET + s * 8);
+    accumulateAvx2(acc, p + len - STRIPE, SECRET + sizeof XXH3_SECRET - STRIPE - 7);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), acc[0]);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 4), acc[1]);
+}
+#endif
+
+using Stripes = void (*)(uint64_t[8], const char*, size_t);
+
+Stripes pickStripes() {
+#ifdef VCSIM_HAVE_AVX2_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return stripesAvx2;
+#endif
+    return stripesScalar;
+}
+
+const Stripes bestStripes = pickStripes();
+
+uint64_t xxh3(string_view data, Stripes stripes) {
+    const char* p = data.data();
+    size_t len = data.size();
+    if (len <= 16) return upTo16(p, len);
+    if (len <= 128) return upTo128(p, len);
+    if (len <= 240) return upTo240(p, len);
+    uint64_t acc[8] = {P32_3, P64_1, P64_2, P64_3, P64_4, P32_2, P64_5, P32_1};
+    stripes(acc, p, len);
+    uint64_t h = len * P64_1;
+    for (int i = 0; i < 4; ++i) h += fold64(acc[2 * i] ^ read64(SECRET + 11 + 16 * i), acc[2 * i + 1] ^ read64(SECRET + 19 + 16 * i));
+    return avalanche(h);
+}
+}  // namespace
+
+uint64_t FastHash::of(string_view data) { return xxh3(data, bestStripes); }
+uint64_t FastHash::ofScalar(string_view data) { return xxh3(data, stripesScalar); }
+bool FastHash::vectorized() { return bestStripes != stripesScalar; }
+
+bool ContentSource::stream(const function<bool(string_view)>& sink) const {
+    string data;
+    return load(data) && sink(data);
+}
+
+void File::stage(shared_ptr<const string> c) {
+    stagedContent = move(c);
+    stagedSource.reset();
+    stagedHashed = false;
+}
+
+void File::stage(shared_ptr<const ContentSource> src, uint64_t hash) {
+    stagedContent.reset();
+    stagedSource = move(src);
+    stagedHash = hash;
+    stagedHashed = true;
+}
+
+void File::materialize() const {
+    if (content) return;
+    string data;
+    if (!source->load(data)) cout << "Warning: content of " << name << " is unavailable." << endl;
+    content = make_shared<const string>(move(data));
+    if (!stagedContent && !stagedSource) stagedContent = content;
+    source.reset();
+}
+
+const string& File::staged() const {
+    if (!stagedContent && !stagedSource) materialize();
+    if (!stagedContent) {
+        string data;
+        if (!stagedSource->load(data)) cout << "Warning: content of " << name << " is unavailable." << endl;
+        stagedContent = make_shared<const string>(move(data));
+        stagedSource.reset();
+    }
+    return *stagedContent;
+}
+
+File::File(string n, string c) 
+    : name(move(n)), content(make_shared<const string>(move(c))), stagedContent(content), forced(false) {}
+
+File::File(string n, shared_ptr<const string> c)
+    : name(move(n)), content(move(c)), stagedContent(content), forced(false) {}
+
+File::File(string n, shared_ptr<const string> c, uint64_t hash)
+    : name(move(n)), content(move(c)), stagedContent(content), forced(false), contentHash(hash), contentHashed(true) {}
+
+File::File(string n, shared_ptr<const ContentSource> src, uint64_t hash)
+    : name(move(n)), source(move(src)), forced(false), contentHash(hash), contentHashed(true) {}
+
+void File::updateContent(shared_ptr<const string> c, uint64_t hash) {
+    stage(move(c));
+    stagedHash = hash;
+    stagedHashed = true;
+}
+
+void File::stageFrom(const File& other) {
+    if (other.content) updateContent(other.content, other.getContentHash());
+    else stage(other.source, other.contentHash);
+}
+
+void File::restage(shared_ptr<const ContentSource> src) {
+    if (stagedInMemory()) return;
+    if (stagedSource) stagedSource = move(src);
+    else source = move(src);
+}
+
+uint64_t File::getContentHash() const {
+    if (!contentHashed) {
+        materialize();
+        VCSIM_TIMED(HASH);
+        VCSIM_BYTES(HASH, content->size());
+        contentHash = ContentHash::of(*content);
+        contentHashed = true;
+    }
+    return contentHash;
+}
+
+uint64_t File::getStagedHash() const {
+    if (stagedIsContent()) return getContentHash();
+    if (!stagedHashed) {
+        VCSIM_TIMED(HASH);
+        VCSIM_BYTES(HASH, stagedContent->size());
+        stagedHash = ContentHash::of(*stagedContent);
+        stagedHashed = true;
+    }
+    return stagedHash;
+}
+
+bool File::sameContent() const {
+    if (stagedIsContent()) return true;
+    if (!content || !stagedContent) return getStagedHash() == getContentHash();
+    if (content->size() != stagedContent->size()) return false;
+    if (contentHashed && stagedHashed && contentHash != stagedHash) return false;
+    return *content == *stagedContent;
+}
+
+void File::clearModified() noexcept { 
+    forced = false; 
+    if (!stagedIsContent()) {
+        content = stagedContent;
+        source = move(stagedSource);
+        contentHash = stagedHash;
+        contentHashed = stagedHashed;
+    }
+}
+
+bool File::saveToDisk() const {
+    if (content) return writeAtomic(name, *content);
+    return writeAtomic(name, *source);
+}
+
+bool File::streamStaged(const function<bool(string_view)>& sink) const {
+    if (stagedContent) return sink(*stagedContent);
+    if (stagedSource) return stagedSource->stream(sink);
+    if (content) return sink(*content);
+    return source->stream(sink);
+}
+
+bool File::writeStaged(const string& path) const {
+    if (stagedInMemory()) return writeBytes(path, getStagedContentView());
+    if (stagedSource) return writeBytes(path, *stagedSource);
+    return writeBytes(path, *source);
+}
+
+size_t File::streamThreshold() {
+    static const size_t limit = [] {
+        const char* v = getenv("VCSIM_STREAM_SIZE");
+        return v && atoll(v) > 0 ? size_t(atoll(v)) : size_t(8) << 20;
+    }();
+    return limit;
+}
+
+bool File::writeBytes(const string& path, string_view data) {
+    VCSIM_TIMED(FILE_WRITE);
+    VCSIM_BYTES(FILE_WRITE, data.size());
+    ofstream out(path, ios::binary);
+    out.write(data.data(), data.size());
+    out.close();
+    return bool(out);
+}
+
+bool File::writeBytes(const string& path, const ContentSource& src) {
+    ofstream out(path, ios::binary);
+    bool ok = src.stream([&](string_view piece) {
+        VCSIM_TIMED(FILE_WRITE);
+        VCSIM_BYTES(FILE_WRITE, piece.size());
+        return bool(out.write(piece.data(), piece.size()));
+    });
+    out.close();
+    return ok && bool(out);
+}
+
+bool File::hashOnDisk(const string& path, uint64_t& hash) {
+    ContentHash::Stream h;
+    if (!readChunks(path, [&](string_view piece) {
+            VCSIM_TIMED(HASH);
+            VCSIM_BYTES(HASH, piece.size());
+            h.update(piece);
+            return true;
+        }))
+        return false;
+    hash = h.digest();
+    return true;
+}
+
+// Reads the file in one bulk read into a buffer sized from the file length and
+// moves that buffer into the File, so the bytes (line endings and a missing
+// trailing newline included) arrive unchanged and are copied only by the read.
+// Binary content makes a BinaryFile. A file above streamThreshold() is only
+// hashed, a chunk at a time, and stays on disk behind a lazy BinaryFile.
+// Without a pool the File is a plain make_shared allocation (for temporaries).
+shared_ptr<File> File::loadFromDisk(const string& fname, MemoryPool* pool) {
+    error_code ec;
+    uintmax_t size = fs::file_size(fname, ec);
+    if (ec) return nullptr;
+    if (size > streamThreshold()) {
+        uint64_t hash;
+        if (!hashOnDisk(fname, hash)) return nullptr;
+        auto src = make_shared<DiskSource>(fname);
+        if (pool) return pool->make<BinaryFile>(fname, move(src), hash);
+        return make_shared<BinaryFile>(fname, move(src), hash);
+    }
+    VCSIM_TIMED(FILE_LOAD);
+    VCSIM_BYTES(FILE_LOAD, size);
+    ifstream in(fname, ios::binary);
+    if (!in) return nullptr;
+    string content(size, '\0');
+    in.read(&content[0], size);
+    content.resize(in.gcount());
+    in.close();
+    auto data = make_shared<const string>(move(content));
+    if (looksBinary(*data)) {
+        if (pool) return pool->make<BinaryFile>(fname, move(data));
+        return make_shared<BinaryFile>(fname, move(data));
+    }
+    if (pool) return pool->make<TextFile>(fname, move(data));
+    return make_shared<TextFile>(fname, move(data));
+}
+
+bool DiskSource::load(string& out) const {
+    out.clear();
+    return File::readChunks(path, [&](string_view piece) { out.append(piece); return true; });
+}
+
+void TextFile::show(ostream& os, const string& name, string_view content) {
+    os << "[TextFile] " << name << ": " << content << '\n';
+}
+
+bool FileSet::insert(const shared_ptr<File>& f) {
+    auto it = byName.find(f->getName());
+    if (it != byName.end()) {
+        if (*it->second == f) return false;
+        *it->second = f;
+        return true;
+    }
+    byName.emplace(f->getName(), order.insert(order.end(), f));
+    return true;
+}
+
+shared_ptr<File> FileSet::find(const string& name) const {
+    auto it = byName.find(name);
+    return it == byName.end() ? nullptr : *it->second;
+}
+
+bool FileSet::erase(const string& name) {
+    auto it = byName.find(name);
+    if (it == byName.end()) return false;
+    order.erase(it->second);
+    byName.erase(it);
+    return true;
+}
+
+ThreadPool::ThreadPool(size_t n) {
+    for (size_t i = 0; i < max<size_t>(n, 1); ++i) {
+        workers.emplace_back([this]() {
+            while (true) {
+                function<void()> task;
+                {
+                    unique_lock<mutex> lock(m);
+                    cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                    if (tasks.empty()) return;
+                    task = move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    { lock_guard<mutex> lock(m); stopping = true; }
+    cv.notify_all();
+    for (thread& t : workers) t.join();
+}
+
+bool Sync::enabled() {
+    static const bool on = [] { const char* v = getenv("VCSIM_FSYNC"); return !v || string(v) != "0"; }();
+    return on;
+}
+
+bool Sync::all(const string& dir) {
+    if (!enabled()) return true;
+    VCSIM_TIMED(SYNC);
+#if defined(__linux__)
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool ok = ::syncfs(fd) == 0;
+    ::close(fd);
+    return ok;
+#elif !defined(_WIN32)
+    ::sync();
+    return true;
+#else
+    return true;
+#endif
+}
+
+bool RepoLock::lock(bool wait) {
+#ifndef _WIN32
+    if (fd >= 0) return true;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    const char* t = getenv("VCSIM_LOCK_TIMEOUT");
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(t ? atoi(t) : 30);
+    while (::flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        if ((errno != EWOULDBLOCK && errno != EINTR) || !wait || chrono::steady_clock::now() >= deadline) {
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+#endif
+    return true;
+}
+
+void RepoLock::unlock() {
+#ifndef _WIN32
+    if (fd < 0) return;
+    ::flock(fd, LOCK_UN);
+    ::close(fd);
+    fd = -1;
+#endif
+}
+
+bool MappedFile::open(const string& path) {
+    close();
+#ifdef _WIN32
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    base = buffer.data();
+    length = buffer.size();
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+    length = size_t(st.st_size);
+    if (length > 0) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { ::close(fd); length = 0; return false; }
+        base = static_cast<const char*>(p);
+    }
+    ::close(fd);
+    return true;
+#endif
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    buffer.clear();
+#else
+    if (base) munmap(const_cast<char*>(base), length);
+#endif
+    base = nullptr;
+    length = 0;
+}
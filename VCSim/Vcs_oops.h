@@ -0,0 +1,1944 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <climits>
+#include <string>
+#include <string_view>
+#include <ctime>
+#include <memory>
+#include <memory_resource>
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <queue>
+#include <atomic>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+namespace fs = std::filesystem;
+
+// Hot-path instrumentation: per-metric call counts, time and bytes, kept in
+// relaxed atomics so worker threads record without locking. Times from
+// parallel phases are summed over threads. With VCSIM_TRACE=<file> in the
+// environment every timed scope is also kept as a Chrome trace event
+// (chrome://tracing, Perfetto) and written to <file> at exit. Building with
+// VCSIM_NO_STATS compiles every probe out.
+class Stats {
+public:
+    enum Metric {
+        FILE_LOAD, FILE_WRITE, HASH, DELTA, CHUNK, COMPRESS, DECOMPRESS, OBJECT_READ, OBJECT_WRITE, SYNC,
+        COMMIT, COMMIT_STORE, COMMIT_WRITE_FILES, COMMIT_RECORD, CHECKOUT, LOG, GC, METRIC_COUNT
+    };
+
+    static const char* name(Metric m);
+
+    // CPU-bound work versus time spent waiting on the filesystem.
+    static bool isCpu(Metric m) { return m == HASH || m == DELTA || m == CHUNK || m == COMPRESS || m == DECOMPRESS; }
+    static bool isIo(Metric m) { return m == FILE_LOAD || m == FILE_WRITE || m == OBJECT_READ || m == OBJECT_WRITE || m == SYNC; }
+
+    static Stats& get();
+    void add(Metric m, uint64_t ns);
+    void addBytes(Metric m, uint64_t n) { counters[m].bytes.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t calls(Metric m) const { return counters[m].calls.load(std::memory_order_relaxed); }
+
+    void reset();
+
+    class Scope {
+        Metric metric;
+        std::chrono::steady_clock::time_point start;
+    public:
+        // get() first, so the trace epoch never postdates the first start time.
+        explicit Scope(Metric m) : metric(m), start((Stats::get(), std::chrono::steady_clock::now())) {}
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope() { Stats::get().finish(metric, start, std::chrono::steady_clock::now()); }
+    };
+
+    void report(std::ostream& os) const;
+    void writeJson(std::ostream& os) const;
+
+    bool tracing() const { return !tracePath.empty(); }
+
+    bool writeTrace(const std::string& path) const;
+
+private:
+    struct Counter {
+        std::atomic<uint64_t> calls{0}, ns{0}, maxNs{0}, bytes{0};
+    };
+    struct Event {
+        Metric metric;
+        unsigned thread;
+        double startUs, durUs;
+    };
+    static const size_t MAX_EVENTS = 1 << 20;
+
+    Counter counters[METRIC_COUNT];
+    std::string tracePath;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    mutable std::mutex traceMutex;
+    std::vector<Event> events;
+
+    Stats();
+    ~Stats();
+    static unsigned threadNumber();
+    void finish(Metric m, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+};
+
+#define VCSIM_CONCAT2(a, b) a##b
+#define VCSIM_CONCAT(a, b) VCSIM_CONCAT2(a, b)
+#ifdef VCSIM_NO_STATS
+#define VCSIM_TIMED(metric) ((void)0)
+#define VCSIM_BYTES(metric, n) ((void)0)
+#else
+// Times the rest of the enclosing block under Stats::metric.
+#define VCSIM_TIMED(metric) Stats::Scope VCSIM_CONCAT(vcsimScope, __LINE__)(Stats::metric)
+#define VCSIM_BYTES(metric, n) Stats::get().addBytes(Stats::metric, (n))
+#endif
+
+// Per-repository pool that File, Commit and their shared_ptr control blocks
+// are allocated from (one allocation each, via allocate_shared). Blocks come
+// out of large chunks and are recycled when objects die, so bulk commits and
+// checkouts do a few big allocations instead of one malloc per object.
+// Safe for concurrent use.
+class MemoryPool {
+    std::pmr::synchronized_pool_resource resource;
+public:
+    MemoryPool() : resource(std::pmr::pool_options{4096, 1024}) {}
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
+    template <class T, class... Args>
+    std::shared_ptr<T> make(Args&&... args) {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(&resource), std::forward<Args>(args)...);
+    }
+};
+
+// XXH64, the hash that names stored objects and backs change detection.
+// Each 32-byte stripe feeds four 64-bit multiply chains, which keep a scalar
+// core's multipliers busy; there is no 64-bit vector multiply before
+// AVX-512, so a SIMD version would not be faster and would still have to
+// produce these exact values, because they are object names on disk.
+class ContentHash {
+    static constexpr uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL,
+                              P3 = 1609587929392839161ULL,  P4 = 9650029242287828579ULL,
+                              P5 = 2870177450012600261ULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t read64(const char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    static uint32_t read32(const char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    static uint64_t round(uint64_t acc, uint64_t in) { return rotl(acc + in * P2, 31) * P1; }
+    static uint64_t merge(uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; }
+
+    // Feeds every whole 32-byte stripe in [p, end); returns where it stopped.
+    static const char* stripes(uint64_t v[4], const char* p, const char* end);
+    static uint64_t converge(const uint64_t v[4]);
+
+    // The last len % 32 bytes, then the avalanche.
+    static uint64_t finish(uint64_t h, uint64_t len, const char* p, const char* end);
+
+public:
+    // XXH64 (little-endian input)
+    static uint64_t of(std::string_view data);
+
+    // of() over data that arrives in pieces; any split gives the same value.
+    class Stream {
+        uint64_t v[4] = {P1 + P2, P2, 0, 0 - P1};
+        char pending[32];
+        size_t buffered = 0;
+        uint64_t total = 0;
+    public:
+        void update(std::string_view data);
+        uint64_t digest() const;
+    };
+
+    static std::string hex(uint64_t h);
+};
+
+// XXH3 (64 bits, seed 0), for hashes that never leave memory, such as the
+// line hashes diffs and deltas match lines by. Inputs over 240 bytes run
+// through an AVX2 kernel when the CPU has one (checked once, at run time)
+// and a scalar one otherwise; both give the same values. Object names stay
+// XXH64: they are on disk, and new names would orphan every stored object.
+class FastHash {
+public:
+    static uint64_t of(std::string_view data);
+    // The scalar kernel whatever the CPU, to check the other against.
+    static uint64_t ofScalar(std::string_view data);
+    static bool vectorized();
+
+    // For hash tables keyed by string_view.
+    struct Hasher {
+        size_t operator()(std::string_view s) const { return size_t(of(s)); }
+    };
+};
+
+// Where a lazy File's content comes from (e.g. an object store blob).
+// stream() hands the bytes over in pieces, for content too large to hold.
+class ContentSource {
+public:
+    virtual ~ContentSource() {}
+    virtual bool load(std::string& out) const = 0;
+    virtual bool stream(const std::function<bool(std::string_view)>& sink) const;
+};
+
+// Contents are immutable, reference-counted buffers: copying a File (clone(),
+// snapshots) shares them, and an edit swaps in a new buffer instead of
+// writing through, so every copy is effectively copy-on-write.
+//
+// isModified() compares content, so an edit that restores the committed text
+// is no change at all. Each buffer's hash is computed on first use and kept
+// until the buffer is replaced; a File is hashed by one thread at a time.
+//
+// A File built from a ContentSource is lazy: it knows its hash but holds no
+// content until something reads it. Staged content can be lazy too (a large
+// file added from disk); either side streams in chunks wherever it goes
+// (saveToDisk(), writeStaged(), streamStaged()) without being loaded.
+class File {
+protected:
+    std::string name;
+    mutable std::shared_ptr<const std::string> content;        // null while lazy
+    mutable std::shared_ptr<const std::string> stagedContent;  // null while lazy
+    mutable std::shared_ptr<const ContentSource> source;
+    mutable std::shared_ptr<const ContentSource> stagedSource;  // null unless staged is lazy and differs
+    bool forced;  // commit even if the content matches (never-committed files)
+    mutable uint64_t contentHash = 0, stagedHash = 0;
+    mutable bool contentHashed = false, stagedHashed = false;
+
+    void stage(std::shared_ptr<const std::string> c);
+    void stage(std::shared_ptr<const ContentSource> src, uint64_t hash);
+
+    bool stagedIsContent() const { return stagedContent ? stagedContent == content : !stagedSource; }
+
+    void materialize() const;
+    const std::string& staged() const;
+public:
+    File(std::string n, std::string c = "");
+    File(std::string n, std::shared_ptr<const std::string> c);
+    File(std::string n, std::shared_ptr<const std::string> c, uint64_t hash);
+    File(std::string n, std::shared_ptr<const ContentSource> src, uint64_t hash);
+
+    virtual ~File() {}
+
+    virtual void showContent(std::ostream& os) const = 0;
+    void showContent() const { showContent(std::cout); }
+
+    void updateContent(const std::string& c) { stage(std::make_shared<const std::string>(c)); }
+    void updateContent(std::string&& c) { stage(std::make_shared<const std::string>(std::move(c))); }
+    // Stages an existing buffer (e.g. one just read from disk) without copying it.
+    void updateContent(std::shared_ptr<const std::string> c) { stage(std::move(c)); }
+    // Same, for a buffer whose hash the caller already computed.
+    void updateContent(std::shared_ptr<const std::string> c, uint64_t hash);
+    // Stages other's content as it is held: shared if loaded, else lazily.
+    void stageFrom(const File& other);
+    // Points lazy staged content at another source of the same bytes (e.g.
+    // the object store, once it holds them).
+    void restage(std::shared_ptr<const ContentSource> src);
+    bool stagedInMemory() const { return stagedContent || (!stagedSource && content); }
+
+    const std::string& getContent() const { materialize(); return *content; }
+    const std::string& getStagedContent() const { return staged(); }
+    std::string_view getContentView() const { materialize(); return *content; }
+    std::string_view getStagedContentView() const { return staged(); }
+    std::shared_ptr<const std::string> getSharedContent() const { materialize(); return content; }
+    std::shared_ptr<const std::string> getSharedStagedContent() const { staged(); return stagedContent; }
+    const std::string& getName() const { return name; }
+
+    uint64_t getContentHash() const;
+    uint64_t getStagedHash() const;
+
+    // Cheap checks first: shared buffer, size, then hashes already known.
+    // Only same-size buffers with no hash difference on record are compared,
+    // with memcmp (whose SIMD variant libc picks for the CPU at load time).
+    // A side that is not loaded is compared by hash, as stored objects are.
+    bool sameContent() const;
+
+    bool isModified() const { return forced || !sameContent(); }
+    void markModified() { forced = true; }
+    // Commits the staged buffer: a pointer handoff, never a content copy.
+    void clearModified() noexcept;
+    virtual bool saveToDisk() const;
+    bool streamStaged(const std::function<bool(std::string_view)>& sink) const;
+    bool writeStaged(const std::string& path) const;
+
+    // Unit of streamed reads and writes.
+    static constexpr size_t CHUNK = 1 << 20;
+
+    // Files above this size (VCSIM_STREAM_SIZE bytes, default 8 MiB) are
+    // never read whole; they load as BinaryFiles that stream from disk.
+    static size_t streamThreshold();
+
+    // A NUL in the first 8000 bytes, the test git uses.
+    static bool looksBinary(std::string_view data) { return data.substr(0, 8000).find('\0') != std::string_view::npos; }
+
+    static bool writeBytes(const std::string& path, std::string_view data);
+
+    // Writes whatever src streams, one piece at a time.
+    static bool writeBytes(const std::string& path, const ContentSource& src);
+
+    // Calls f with path's bytes in CHUNK-sized pieces; stops early if f
+    // returns false.
+    template <class F>
+    static bool readChunks(const std::string& path, F f) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::string buf(CHUNK, '\0');
+        for (;;) {
+            size_t got;
+            {
+                VCSIM_TIMED(FILE_LOAD);
+                in.read(&buf[0], CHUNK);
+                got = size_t(in.gcount());
+                VCSIM_BYTES(FILE_LOAD, got);
+            }
+            if (got && !f(std::string_view(buf.data(), got))) return false;
+            if (!in) return in.eof();
+        }
+    }
+
+    static bool hashOnDisk(const std::string& path, uint64_t& hash);
+
+    // Where a new version of path is written before it is renamed over it.
+    static std::string pendingPath(const std::string& path) { return path + ".vcs-new"; }
+
+    // Readers of path see the old content or the new, never a partial write.
+    template <class Data>
+    static bool writeAtomic(const std::string& path, const Data& data) {
+        std::string tmp = pendingPath(path);
+        std::error_code ec;
+        fs::path parent = fs::path(path).parent_path();
+        if (!parent.empty()) fs::create_directories(parent, ec);
+        if (!writeBytes(tmp, data)) { fs::remove(tmp, ec); return false; }
+        fs::rename(tmp, path, ec);
+        if (ec) fs::remove(tmp, ec);
+        return !ec;
+    }
+
+    static std::shared_ptr<File> loadFromDisk(const std::string& fname, MemoryPool* pool = nullptr);
+};
+
+// A working file read straight from disk; stream() goes one chunk at a time.
+// Its hash is taken when the File is made, so a reader of the stream checks
+// that the file has not changed since.
+class DiskSource : public ContentSource {
+    std::string path;
+public:
+    explicit DiskSource(std::string p) : path(std::move(p)) {}
+    bool load(std::string& out) const override;
+    bool stream(const std::function<bool(std::string_view)>& sink) const override { return File::readChunks(path, sink); }
+};
+
+class TextFile : public File {
+public:
+    TextFile(std::string n, std::string c = "") : File(std::move(n), std::move(c)) {}
+    TextFile(std::string n, std::shared_ptr<const std::string> c) : File(std::move(n), std::move(c)) {}
+    TextFile(std::string n, std::shared_ptr<const std::string> c, uint64_t hash) : File(std::move(n), std::move(c), hash) {}
+    TextFile(std::string n, std::shared_ptr<const ContentSource> src, uint64_t hash) : File(std::move(n), std::move(src), hash) {}
+    using File::showContent;
+    void showContent(std::ostream& os) const override { show(os, name, getStagedContentView()); }
+    static void show(std::ostream& os, const std::string& name, std::string_view content);
+};
+
+// Bytes that are not edited or diffed as text: binary content, and files
+// too large to load, which stay on disk (or in the store) and stream.
+class BinaryFile : public File {
+public:
+    BinaryFile(std::string n, std::shared_ptr<const std::string> c) : File(std::move(n), std::move(c)) {}
+    BinaryFile(std::string n, std::shared_ptr<const std::string> c, uint64_t hash) : File(std::move(n), std::move(c), hash) {}
+    BinaryFile(std::string n, std::shared_ptr<const ContentSource> src, uint64_t hash) : File(std::move(n), std::move(src), hash) {}
+    using File::showContent;
+    void showContent(std::ostream& os) const override { show(os, name); }
+    static void show(std::ostream& os, const std::string& name) { os << "[BinaryFile] " << name << ": binary content not shown\n"; }
+};
+
+// Insertion-ordered set of files keyed by path, with O(1) average insert,
+// lookup and erase. Inserting a file whose path is already present replaces
+// the old entry in place. The set shares ownership of its files.
+class FileSet {
+    std::list<std::shared_ptr<File>> order;
+    std::unordered_map<std::string, std::list<std::shared_ptr<File>>::iterator> byName;
+public:
+    FileSet() = default;
+    FileSet(const FileSet&) = delete;
+    FileSet& operator=(const FileSet&) = delete;
+    FileSet(FileSet&&) = default;
+    FileSet& operator=(FileSet&&) = default;
+
+    // Returns false if this exact file was already in the set.
+    bool insert(const std::shared_ptr<File>& f);
+    std::shared_ptr<File> find(const std::string& name) const;
+
+    bool contains(const std::string& name) const { return byName.count(name) > 0; }
+
+    bool erase(const std::string& name);
+
+    void reserve(size_t n) { byName.reserve(n); }
+    void clear() { order.clear(); byName.clear(); }
+    size_t size() const { return order.size(); }
+    bool empty() const { return order.empty(); }
+    std::list<std::shared_ptr<File>>::const_iterator begin() const { return order.begin(); }
+    std::list<std::shared_ptr<File>>::const_iterator end() const { return order.end(); }
+};
+
+// Fixed set of worker threads fed from one task queue.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+public:
+    explicit ThreadPool(size_t n = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    size_t size() const { return workers.size(); }
+
+    template <class F>
+    std::future<std::invoke_result_t<F>> submit(F f) {
+        auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::move(f));
+        std::future<std::invoke_result_t<F>> result = task->get_future();
+        { std::lock_guard<std::mutex> lock(m); tasks.emplace([task]() { (*task)(); }); }
+        cv.notify_one();
+        return result;
+    }
+
+    // Runs body(i) for every i in [0, n) across the workers and waits for all of them.
+    template <class F>
+    void parallelFor(size_t n, F body) {
+        if (n == 0) return;
+        std::atomic<size_t> next(0);
+        std::vector<std::future<void>> done;
+        for (size_t w = 0; w < std::min(n, size()); ++w) {
+            done.push_back(submit([&]() {
+                for (size_t i = next++; i < n; i = next++) body(i);
+            }));
+        }
+        for (auto& d : done) d.get();
+    }
+};
+
+// Durability barrier. all() flushes every pending write on the filesystem
+// holding dir in one call (syncfs on Linux), so a caller that wrote many
+// files pays for one sync instead of one per file. VCSIM_FSYNC=0 turns
+// syncing off.
+class Sync {
+public:
+    static bool enabled();
+    static bool all(const std::string& dir);
+};
+
+// The repository's writer lock: an flock on .vcs/lock, so one process (and,
+// with the caller's own mutex, one thread) changes refs, the commit log or
+// the index at a time, and the kernel drops the lock if its holder dies.
+// Readers never take it. lock() waits up to VCSIM_LOCK_TIMEOUT seconds
+// (default 30) for another writer, or not at all when wait is false.
+class RepoLock {
+    std::string path;
+    int fd = -1;
+public:
+    explicit RepoLock(std::string p) : path(std::move(p)) {}
+    RepoLock(const RepoLock&) = delete;
+    RepoLock& operator=(const RepoLock&) = delete;
+    ~RepoLock() { unlock(); }
+
+    bool lock(bool wait = true);
+    void unlock();
+};
+
+// Read-only view of a whole file, memory-mapped where the platform allows
+// (read into memory otherwise). Opening is O(1) in the file size on POSIX.
+class MappedFile {
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    std::string buffer;
+#endif
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+};
+
+// Line-based deltas between two revisions of a text. A delta is a sequence of
+// ops, each either COPY <first base line> <line count> or INSERT <byte count>
+// <bytes>; integers are LEB128 varints. Lines keep their terminators, so
+// applying a delta reproduces the target byte for byte.
+class LineDelta {
+    enum Op : char { COPY = 1, INSERT = 2 };
+
+    static std::vector<std::string_view> splitLines(const std::string& s);
+    static void putVarint(std::string& out, uint64_t v);
+    static bool getVarint(const std::string& in, size_t& pos, uint64_t& v);
+
+public:
+    static std::string make(const std::string& base, const std::string& target);
+    static bool apply(const std::string& base, const std::string& delta, std::string& out);
+};
+
+// FastCDC content-defined chunking. A chunk ends where a gear rolling hash
+// of the last 64 bytes has every bit of a mask clear, so an insertion or
+// deletion moves only the boundaries next to it and every other chunk keeps
+// its name. Normalized chunking (a stricter mask before AVG, a looser one
+// after) keeps sizes close to AVG, and every cut falls within [MIN, MAX].
+//
+// A gear hash forgets a byte after 64 steps, so the hash at any position
+// follows from the 64 bytes before it. cut() uses that to scan four blocks
+// at once, each warmed up on the 64 bytes before it: four independent
+// shift-add chains instead of one, the trick ContentHash uses (the table
+// lookups would need AVX-512 gathers to vectorize). The result is exactly
+// that of the one-chain scan.
+class Chunker {
+public:
+    static constexpr size_t MIN = 256 << 10, AVG = 1 << 20, MAX = 4 << 20;
+
+private:
+    // Gear hash bit k depends on the last k + 1 bytes, so masks use the top bits.
+    static constexpr uint64_t MASK_S = ~uint64_t(0) << (64 - 22);  // before AVG
+    static constexpr uint64_t MASK_L = ~uint64_t(0) << (64 - 18);  // from AVG on
+    static constexpr size_t WINDOW = 64, BLOCK = 4096, LANES = 4, ROUND = BLOCK * LANES;
+    static_assert((AVG - MIN) % ROUND == 0, "a round never straddles AVG");
+
+    // Fixed forever: the table decides where chunks end, and with it which
+    // chunks two revisions (or two repositories) share.
+    struct Gear {
+        uint64_t t[256] = {};
+        constexpr Gear() {
+            uint64_t x = 0x76637369636463ULL;  // splitmix64
+            for (uint64_t& v : t) {
+                uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                v = z ^ (z >> 31);
+            }
+        }
+    };
+
+public:
+    // Length of the chunk that starts at data, given n bytes from there; n
+    // is below MAX only at the end of the input.
+    static size_t cut(const char* data, size_t n);
+};
+
+// Compression codecs for stored objects. Each has a stable one-byte id that
+// is written into the object header, so objects compressed with different
+// codecs can sit side by side in one store.
+class Codec {
+public:
+    virtual ~Codec() {}
+    virtual uint8_t id() const = 0;
+    virtual const char* name() const = 0;
+    virtual bool compress(std::string_view in, std::string& out) const = 0;
+    // rawSize is the exact decompressed size recorded in the object header.
+    virtual bool decompress(std::string_view in, size_t rawSize, std::string& out) const = 0;
+    // The most in can decompress to. Object headers are not trusted: a
+    // rawSize above this is refused before anything is allocated for it.
+    virtual uint64_t maxRawSize(std::string_view in) const = 0;
+
+    static const Codec* byId(uint8_t id);
+    static const Codec* byName(const std::string& name);
+};
+
+class NoCodec : public Codec {
+public:
+    uint8_t id() const override { return 0; }
+    const char* name() const override { return "none"; }
+    bool compress(std::string_view in, std::string& out) const override { out.assign(in); return true; }
+    bool decompress(std::string_view in, size_t rawSize, std::string& out) const override;
+    uint64_t maxRawSize(std::string_view in) const override { return in.size(); }
+};
+
+// Self-contained LZ4 block-format codec (greedy matcher with a 64K-entry hash
+// table). Output is readable by any LZ4_decompress_safe implementation.
+class Lz4Codec : public Codec {
+    static const size_t MIN_MATCH = 4, LAST_LITERALS = 5, MF_LIMIT = 12;
+
+    static void putLength(std::string& out, size_t len);
+    static void emit(std::string& out, const char* lit, size_t litLen, size_t offset, size_t matchLen);
+
+public:
+    uint8_t id() const override { return 1; }
+    const char* name() const override { return "lz4"; }
+
+    bool compress(std::string_view in, std::string& out) const override;
+    bool decompress(std::string_view in, size_t rawSize, std::string& out) const override;
+
+    // Every byte yields at most 255 more of a match length.
+    uint64_t maxRawSize(std::string_view in) const override { return uint64_t(in.size()) * 255; }
+};
+
+// A pack bundles many objects into one file. pack-<name>.pack holds the
+// object files' bytes back to back, exactly as they would be stored loose;
+// pack-<name>.idx is "VCSPACK1", a 256-entry u32 fanout table (cumulative
+// object count by first hash byte), then one 24-byte entry per object sorted
+// by hash: hash u64 | offset u64 | length u64. Both files are memory-mapped
+// and a lookup is a binary search inside one fanout bucket.
+class PackFile {
+    static constexpr char MAGIC[9] = "VCSPACK1";
+    static const size_t FANOUT_SIZE = 256 * 4;
+    static const size_t ENTRY_SIZE = 24;
+
+    MappedFile data, idx;
+    size_t count = 0;
+    std::string basePath;
+
+    const char* entry(size_t i) const { return idx.data() + 8 + FANOUT_SIZE + i * ENTRY_SIZE; }
+    uint32_t fanout(int b) const;
+
+public:
+    static uint64_t parseHash(const std::string& hex) { return hex.size() == 16 ? strtoull(hex.c_str(), nullptr, 16) : 0; }
+
+
+    bool open(const std::string& base);
+
+    const std::string& path() const { return basePath; }
+    size_t size() const { return count; }
+
+    // Raw object bytes for a hash, pointing into the mapped pack.
+    bool find(uint64_t hash, std::string_view& out) const;
+
+    // Calls f(hash, raw object bytes) for every object in hash order.
+    template <class F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t h, offset, length;
+            memcpy(&h, entry(i), 8);
+            memcpy(&offset, entry(i) + 8, 8);
+            memcpy(&length, entry(i) + 16, 8);
+            if (offset + length <= data.size()) f(h, std::string_view(data.data() + offset, length));
+        }
+    }
+
+    // Writes <base>.pack and <base>.idx for the objects named by hashes
+    // (sorted), asking read(i, bytes) for each one's bytes as it is written,
+    // so only the index and one object are in memory at a time. Both reach
+    // the disk before they are renamed into place and the renames before it
+    // returns, so a caller may delete what the pack replaces once it does.
+    // On failure no temp file is left behind.
+    template <class F>
+    static bool write(const std::string& base, const std::vector<uint64_t>& hashes, F read) {
+        std::string packTmp = base + ".pack.tmp", idxTmp = base + ".idx.tmp";
+        std::ofstream pack(packTmp, std::ios::binary);
+        std::ofstream idxOut;
+        auto discard = [&] {
+            pack.close();
+            idxOut.close();
+            std::error_code ec;
+            fs::remove(packTmp, ec);
+            fs::remove(idxTmp, ec);
+            return false;
+        };
+        std::string index(MAGIC, 8);
+        index.resize(8 + FANOUT_SIZE + hashes.size() * ENTRY_SIZE, '\0');
+        uint32_t counts[256] = {};
+        uint64_t offset = 0;
+        std::string bytes;
+        for (size_t i = 0; i < hashes.size() && pack; ++i) {
+            if (!read(i, bytes)) return discard();
+            uint64_t length = bytes.size();
+            pack.write(bytes.data(), length);
+            char* e = &index[8 + FANOUT_SIZE + i * ENTRY_SIZE];
+            memcpy(e, &hashes[i], 8);
+            memcpy(e + 8, &offset, 8);
+            memcpy(e + 16, &length, 8);
+            offset += length;
+            ++counts[hashes[i] >> 56];
+        }
+        pack.close();
+        uint32_t total = 0;
+        for (int b = 0; b < 256; ++b) {
+            total += counts[b];
+            memcpy(&index[8 + size_t(b) * 4], &total, 4);
+        }
+        idxOut.open(idxTmp, std::ios::binary);
+        idxOut.write(index.data(), index.size());
+        idxOut.close();
+        std::string dir = fs::path(base).parent_path().string();
+        if (dir.empty()) dir = ".";
+        if (!pack || !idxOut || !Sync::all(dir)) return discard();
+        // The pack goes into place before its index, so an index never names a missing pack.
+        std::error_code ec;
+        fs::rename(packTmp, base + ".pack", ec);
+        if (ec) return discard();
+        fs::rename(idxTmp, base + ".idx", ec);
+        if (ec) {
+            fs::remove(base + ".pack", ec);
+            return discard();
+        }
+        return Sync::all(dir);
+    }
+};
+
+// Content-addressed blob store under .vcs/objects. Every blob is named by the
+// hash of its bytes and fanned out by the first two hex digits, so identical
+// contents are written once no matter how many commits reference them.
+//
+// An object file starts with a one-byte kind: 'B' is followed by the raw
+// bytes, 'D' by the 16-hex-digit base hash, one byte of chain depth and a
+// LineDelta against that base, 'C' by a chunk list: one "<hash> <size>" line
+// per chunk, each a 'B' object cut by Chunker, for content stored a chunk at
+// a time (putChunked()). Equal chunks are one object, whichever files and
+// revisions they come from. Compressed objects are prefixed with 'Z', the
+// codec id and the uncompressed payload size (u64), and only the payload after
+// the kind header is compressed. The hash always names the reconstructed
+// content, so callers never see which form an object was stored in.
+//
+// repack() folds loose objects (and, when asked, the existing packs) into a
+// new PackFile under objects/pack; reads look for a loose object first and
+// then in the packs. The pack list is an immutable snapshot swapped
+// atomically, so readers never lock, and a pack replaced by a gc stays mapped
+// for as long as a reader holds the snapshot it was found in.
+class ObjectStore {
+public:
+    struct RepackPlan {
+        const std::unordered_set<uint64_t>* live = nullptr;       // reachable objects; null keeps everything
+        std::vector<std::pair<std::string, std::string>> deltas;  // (whole blob, base) retries, oldest first
+        fs::file_time_type pruneBefore = fs::file_time_type::min();  // unreachable loose objects older than this go
+        bool mergePacks = false;   // fold every existing pack into the new one
+        bool prunePacked = false;  // drop unreachable objects while merging; needs no concurrent writers
+        const std::atomic<bool>* cancel = nullptr;
+    };
+    struct RepackResult { size_t packed = 0, pruned = 0, deltified = 0; };
+
+private:
+    using PackList = std::vector<std::shared_ptr<const PackFile>>;
+
+    std::string root;
+    int maxDeltaDepth;
+    const Codec* codec;
+    const ObjectStore* fallback = nullptr;  // read through when an object is not here
+    mutable std::shared_ptr<const PackList> packs;  // replaced whole, never changed in place
+    // put() holds it shared; deleting loose objects holds it exclusively.
+    mutable std::shared_mutex removal;
+
+    std::shared_ptr<const PackList> packList() const { return std::atomic_load(&packs); }
+
+    static const size_t DELTA_HEADER = 1 + 16 + 1;
+    static const size_t COMPRESSED_HEADER = 1 + 1 + 8;
+    // The longest delta chain read back: what a header's depth byte holds.
+    static const size_t MAX_CHAIN = 255;
+
+    // Object names as hex() writes them; anything else in a header (say a
+    // "../" base) is damage, and never becomes a path.
+    static bool isHash(std::string_view h);
+
+    // Object bytes come either from a loose file or from a mapped pack.
+    struct StreamSource {
+        std::ifstream in;
+        bool read(char* p, size_t n) { return bool(in.read(p, n)); }
+    };
+    struct ViewSource {
+        std::string_view rest;
+        bool read(char* p, size_t n);
+    };
+
+    struct Header {
+        char kind = 0;
+        const Codec* codec = nullptr;
+        uint64_t rawSize = 0;
+        std::string base;
+        int depth = 0;
+        size_t length = 0;
+    };
+
+    template <class Src>
+    static bool readHeader(Src& src, Header& h) {
+        char c;
+        if (!src.read(&c, 1)) return false;
+        h.length = 1;
+        if (c == 'Z') {
+            char id;
+            if (!src.read(&id, 1) || !src.read(reinterpret_cast<char*>(&h.rawSize), 8) || !src.read(&c, 1)) return false;
+            if (!(h.codec = Codec::byId(uint8_t(id)))) return false;
+            h.length += COMPRESSED_HEADER;
+        }
+        h.kind = c;
+        if (c == 'D') {
+            char b[DELTA_HEADER - 1];
+            if (!src.read(b, sizeof b)) return false;
+            h.base.assign(b, 16);
+            h.depth = uint8_t(b[16]);
+            h.length += DELTA_HEADER - 1;
+            if (!isHash(h.base)) return false;
+        }
+        return c == 'B' || c == 'D' || c == 'C';
+    }
+
+    // Calls f(hash, size) for each chunk a 'C' payload lists.
+    template <class F>
+    static bool forEachChunk(const std::string& list, F f) {
+        for (size_t pos = 0; pos < list.size();) {
+            size_t nl = list.find('\n', pos);
+            if (nl == std::string::npos || nl < pos + 18 || list[pos + 16] != ' ') return false;
+            if (!f(list.substr(pos, 16), strtoull(list.c_str() + pos + 17, nullptr, 10))) return false;
+            pos = nl + 1;
+        }
+        return true;
+    }
+
+    // Reads the payload straight into a presized buffer and decompresses it.
+    template <class Src>
+    static bool readPayload(Src& src, const Header& h, size_t total, std::string& payload) {
+        if (total < h.length) return false;
+        payload.resize(total - h.length);
+        {
+            VCSIM_TIMED(OBJECT_READ);
+            VCSIM_BYTES(OBJECT_READ, payload.size());
+            if (!src.read(&payload[0], payload.size())) return false;
+        }
+        if (!h.codec) return true;
+        if (h.rawSize > h.codec->maxRawSize(payload)) return false;
+        VCSIM_TIMED(DECOMPRESS);
+        VCSIM_BYTES(DECOMPRESS, h.rawSize);
+        std::string raw;
+        if (!h.codec->decompress(payload, h.rawSize, raw)) return false;
+        payload = std::move(raw);
+        return true;
+    }
+
+    // Calls f(source, total size) on the object's bytes, wherever they live.
+    // A miss rereads the pack directory once: another process's gc may have
+    // moved the object from a loose file into a pack this one never saw.
+    template <class F>
+    bool withObject(const std::string& hash, F f) const {
+        std::string path = objectPath(hash);
+        std::error_code ec;
+        uintmax_t size = fs::file_size(path, ec);
+        if (!ec) {
+            StreamSource src{std::ifstream(path, std::ios::binary)};
+            if (src.in) return f(src, size_t(size));
+        }
+        uint64_t key = PackFile::parseHash(hash);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (attempt) loadPacks();
+            for (const auto& pack : *packList()) {
+                ViewSource src;
+                if (pack->find(key, src.rest)) return f(src, src.rest.size());
+            }
+        }
+        return fallback && fallback->withObject(hash, f);
+    }
+
+    bool readRaw(const std::string& hash, char& kind, std::string& base, std::string& payload) const;
+
+    // Delta chain length of a stored object: 0 for full blobs, -1 if missing
+    // or chunked (chunked content is never a delta base).
+    int depthOf(const std::string& hash) const;
+    void loadPacks() const;
+
+    // Compresses the payload with the store's codec; false (and nothing
+    // filled in) when that does not shrink it.
+    bool compress(std::string_view payload, std::string& prefix, std::string& packed) const;
+
+    // Writes to a private temp file and renames it into place, so concurrent
+    // writers of the same object (or readers) never see a partial file. Runs
+    // on the commit worker threads.
+    bool writeRaw(const std::string& hash, const std::string& kind, std::string_view payload);
+
+    // The object file of hash holding the parts in order.
+    bool writeObject(const std::string& hash, std::initializer_list<std::string_view> parts);
+
+public:
+    explicit ObjectStore(const std::string& r, int depth = 16);
+
+    // A quarantine: objects written here stay out of main until publish(),
+    // while reads still find main's objects (delta bases, chunks).
+    ObjectStore(const std::string& r, const ObjectStore& main);
+
+    void setCodec(const Codec* c) { if (c) codec = c; }
+    const Codec* getCodec() const { return codec; }
+
+    void setMaxDeltaDepth(int depth) { maxDeltaDepth = std::max(0, std::min(depth, 255)); }
+    int getMaxDeltaDepth() const { return maxDeltaDepth; }
+
+    static std::string hashContent(std::string_view data);
+    std::string objectPath(const std::string& hash) const;
+    bool inPacks(uint64_t key) const;
+
+    // Calls f(hash, path) for every loose object; in-flight temp files are skipped.
+    template <class F>
+    void forEachLoose(F f) const {
+        std::error_code ec;
+        for (fs::directory_iterator d(root, ec), end; !ec && d != end; d.increment(ec)) {
+            std::string dir = d->path().filename().string();
+            if (dir.size() != 2 || !d->is_directory()) continue;
+            for (fs::directory_iterator e(d->path(), ec); !ec && e != end; e.increment(ec)) {
+                std::string name = e->path().filename().string();
+                if (name.size() == 14) f(dir + name, e->path());
+            }
+        }
+    }
+
+    // Retries the planned deltas for whole loose blobs, in order, so a chain
+    // of retries sees each new depth. A retry is kept when the chain stays
+    // within maxDeltaDepth, never leads back to the blob, and the delta is
+    // under half the size. Returns the new object bytes by hash.
+    std::unordered_map<uint64_t, std::string> redeltify(const RepackPlan& plan) const;
+
+public:
+    bool has(const std::string& hash) const;
+
+    // has() for many objects: the pack directory is reread once up front
+    // instead of after every miss.
+    std::vector<char> hasEach(const std::vector<std::string>& hashes) const;
+
+    // has() for a writer about to reference the object: a loose hit gets a
+    // fresh mtime, so a concurrent prune (which spares recent objects) cannot
+    // delete it.
+    bool reuse(const std::string& hash);
+
+    // Kind ('B', 'D' or 'C') and delta base (empty unless 'D') of a stored object.
+    bool peek(const std::string& hash, char& kind, std::string& base) const;
+
+    size_t packCount() const { return packList()->size(); }
+
+    // Loose object count, estimated from one fan-out directory.
+    size_t estimateLoose() const;
+
+    // Writes one new pack holding the reachable loose objects (with the
+    // planned deltas retried) and, with mergePacks, every existing pack's
+    // objects; publishes it; then deletes what it replaced and the
+    // unreachable loose objects past the grace period. Nothing is deleted
+    // unless the pack was written. Runs beside readers and writers: only the
+    // deletions wait for in-flight put() calls.
+    bool repack(const RepackPlan& plan, RepackResult& result);
+
+    // Stores data unless an object with the same hash already exists; returns
+    // the hash, or an empty string if the object could not be written.
+    // Safe to call from several threads at once, and beside a repack().
+    // hash may be passed in when the caller already knows it.
+    std::string put(std::string_view data, std::string hash = "");
+
+    // Like put(), but stores data as a line delta against an existing revision
+    // when that keeps the chain within maxDeltaDepth and actually saves space.
+    std::string putDelta(const std::string& data, const std::string& baseHash, std::string hash = "");
+
+    // Stores content that arrives in pieces (produce(sink) calls sink with
+    // each) as content-defined chunks plus a chunk list named by the hash of
+    // the whole, holding at most Chunker::MAX bytes (and a piece) at a time;
+    // chunks already stored are not written again, and content that is one
+    // chunk is just a blob. Returns "" if a write fails or, when hash is
+    // given, if the content turns out not to match it (the chunks stay
+    // behind for gc).
+    template <class F>
+    std::string putChunked(F produce, const std::string& hash = "") {
+        if (!hash.empty()) {
+            std::shared_lock<std::shared_mutex> lock(removal);
+            if (reuse(hash) && complete(hash)) return hash;
+        }
+        ContentHash::Stream whole;
+        std::string pending, list, last;
+        size_t begin = 0;  // pending[begin..] is not cut yet
+        auto flush = [&](std::string_view chunk) {
+            last = put(chunk);
+            list += last + " " + std::to_string(chunk.size()) + "\n";
+            return !last.empty();
+        };
+        // Cuts while a whole MAX-sized window is buffered (or, at the end,
+        // while anything is), so every cut sees what a one-shot scan would.
+        auto cutPending = [&](bool final) {
+            while (pending.size() - begin >= Chunker::MAX || (final && begin < pending.size())) {
+                size_t len = Chunker::cut(pending.data() + begin, pending.size() - begin);
+                if (!flush(std::string_view(pending).substr(begin, len))) return false;
+                begin += len;
+            }
+            if (begin >= Chunker::MAX) {
+                pending.erase(0, begin);
+                begin = 0;
+            }
+            return true;
+        };
+        bool ok = produce([&](std::string_view piece) {
+            {
+                VCSIM_TIMED(HASH);
+                VCSIM_BYTES(HASH, piece.size());
+                whole.update(piece);
+            }
+            pending.append(piece.data(), piece.size());
+            return cutPending(false);
+        });
+        if (!ok || !cutPending(true) || (list.empty() && !flush(""))) return "";
+        std::string name = ContentHash::hex(whole.digest());
+        if (!hash.empty() && name != hash) return "";
+        // One chunk is the whole content, already stored under its name.
+        if (last == name) return name;
+        std::shared_lock<std::shared_mutex> lock(removal);
+        if (!reuse(name) && !writeRaw(name, "C", list)) return "";
+        return name;
+    }
+
+private:
+    // The content of a full blob or delta, given its own kind, base and
+    // payload: follows the chain down to its full blob, then applies the
+    // deltas on the way back up. The store may be damaged or made by
+    // someone else, so a chain that loops, runs deeper than MAX_CHAIN or
+    // reaches a chunk list fails instead of recursing.
+    bool resolve(const std::string& hash, char kind, std::string base, std::string payload, std::string& out) const;
+
+    // One chunk of a 'C' object: never a chunk list itself, and exactly as
+    // long as the list says.
+    bool getChunk(const std::string& hash, uint64_t size, std::string& out) const;
+
+public:
+    bool get(const std::string& hash, std::string& out) const;
+
+    // get() in pieces: a chunk at a time for chunked objects, else at once.
+    bool stream(const std::string& hash, const std::function<bool(std::string_view)>& sink) const;
+
+    // An object's bytes exactly as stored (header, then the payload, still
+    // compressed), for copying it to another repository.
+    bool rawBytes(const std::string& hash, std::string& out) const;
+
+    // Stores rawBytes() from another repository, unless hash is already
+    // here. Only the header and the size it claims are checked; verify()
+    // checks the content once any delta base or chunks it needs are in too.
+    bool putRaw(const std::string& hash, std::string_view bytes);
+
+    // Moves a quarantine's loose objects into this store.
+    bool publish(const ObjectStore& quarantine);
+
+    // True if the object reads back as content that hashes to its name.
+    bool verify(const std::string& hash) const;
+
+    // has(), and for a chunk list every chunk it names too.
+    bool complete(const std::string& hash) const;
+
+    // The chunks a 'C' object lists; empty for any other object.
+    std::vector<std::string> chunksOf(const std::string& hash) const;
+};
+
+// A blob read from the store on demand, for lazy snapshot files.
+class StoredBlob : public ContentSource {
+    const ObjectStore& store;
+    std::string hash;
+public:
+    StoredBlob(const ObjectStore& s, std::string h) : store(s), hash(std::move(h)) {}
+    bool load(std::string& out) const override { return store.get(hash, out); }
+    bool stream(const std::function<bool(std::string_view)>& sink) const override { return store.stream(hash, sink); }
+};
+
+// Myers diff over hashed lines. Each side is split into lines once and every
+// line is reduced to its XXH3 (FastHash), so the edit search compares 64-bit
+// integers and never the line text. Lines that occur on only one side are set
+// aside first (they can never match), and the search itself is the linear-space
+// middle-snake variant, so memory stays proportional to the line count.
+class LineDiff {
+    std::vector<std::string_view> aLines, bLines;
+    std::vector<uint64_t> a, b;          // hashes of the lines still in play
+    std::vector<size_t> aAt, bAt;        // their original line numbers
+    std::vector<char> deleted, inserted; // result, indexed by original line
+
+    // Open-addressing set of line hashes. XXH3 output is already uniform, so
+    // the low bits pick the slot directly; 0 marks an empty slot and is
+    // tracked on the side.
+    class HashSet {
+        std::vector<uint64_t> slots;
+        size_t mask;
+        bool hasZero = false;
+
+    public:
+        explicit HashSet(const std::vector<uint64_t>& keys);
+        bool contains(uint64_t k) const;
+    };
+
+    static void split(const std::string& s, std::vector<std::string_view>& lines, std::vector<uint64_t>& hashes);
+
+    // Forward and reverse frontiers for bisect(). They only grow, and bisect
+    // puts back -1 in every slot it touched, so a call never pays to clear
+    // the whole 2 * (n + m) range.
+    std::vector<long> v1, v2;
+
+    // Finds the middle snake of a[a0,a1) x b[b0,b1) and returns its start.
+    std::pair<size_t, size_t> bisect(size_t a0, size_t a1, size_t b0, size_t b1);
+    void compare(size_t a0, size_t a1, size_t b0, size_t b1);
+    static void writeLine(std::ostream& os, char tag, std::string_view line);
+
+public:
+    LineDiff(const std::string& before, const std::string& after);
+    bool empty() const;
+
+    // Unified diff hunks with the given number of context lines.
+    void writeUnified(std::ostream& os, size_t context = 3) const;
+};
+
+// Append-only commit history. .vcs/commits.idx is an 8-byte magic followed by
+// fixed-size records (native little-endian):
+//   id u64 | parent u64 | timestamp i64 | message offset u64 | message length u32 | pad u32 | tree hash 16 bytes
+// Messages are appended to .vcs/messages at the recorded offset. The index is
+// memory-mapped on open, so opening a repository is constant time regardless
+// of history length and a record is found by its position (id - 1).
+//
+// Commits are also found by hash through .vcs/commits.hash, a cache of the
+// log rebuilt from it at will: an 8-byte magic, the number of records it
+// covers (u64) and the log's digest() there, then a (hash u64, id u64) pair
+// per record sorted by hash, so a full or short hash is a binary search in
+// the mapped file. Records appended since are hashed on the next lookup.
+class CommitLog {
+public:
+    struct Record {
+        uint64_t id = 0;
+        uint64_t parent = 0;
+        int64_t timestamp = 0;
+        uint64_t messageOffset = 0;
+        uint32_t messageLength = 0;
+        std::string tree;
+    };
+
+private:
+    static constexpr char MAGIC[9] = "VCSIDX1\n";
+    static const size_t HEADER_SIZE = 8;
+    static const size_t RECORD_SIZE = 56;
+    static constexpr char HASHES_MAGIC[9] = "VCSHSH1\n";
+    static const size_t HASHES_HEADER = 32;
+
+    std::string indexPath, messagesPath, hashesPath;
+    MappedFile mapped;
+    size_t mappedCount = 0;
+    size_t count = 0;
+    uint64_t messagesSize = 0;
+
+    // Batched appends not yet written, and what is on disk before them.
+    bool batching = false;
+    std::string pendingMessages, pendingRecords;
+    size_t persistedCount = 0;
+    uint64_t persistedMessagesSize = 0;
+
+    // The hash index as mapped, the records it covers, and those after it
+    // (sorted) that could not be written to it.
+    mutable std::mutex hashesMutex;
+    mutable MappedFile hashes;
+    mutable bool hashesOpened = false;
+    mutable size_t hashed = 0;
+    mutable std::vector<std::pair<uint64_t, uint64_t>> unfiled;
+
+    bool writeAppend(const std::string& messages, const std::string& records);
+    static void decode(const char* p, Record& r);
+    static std::string encode(const Record& r);
+
+    const char* hashEntry(size_t i) const { return hashes.data() + HASHES_HEADER + i * 16; }
+    static uint64_t read64(const char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+    // Maps .vcs/commits.hash when it is whole and matches this log.
+    void openHashes() const;
+
+    // Hashes ids [first, last], reading their messages in one pass.
+    bool hashRecords(size_t first, size_t last, std::vector<std::pair<uint64_t, uint64_t>>& out) const;
+
+    // Brings the hash index up to the records on disk, rewriting the file
+    // when any were missing from it (kept in memory if that fails).
+    void indexHashes() const;
+
+public:
+    bool open(const std::string& dir);
+
+    size_t size() const { return count; }
+
+    // Picks up records other processes appended since open (the mapping stays
+    // as it was; newer records are read from the file). With repair, a record
+    // torn by a crashed writer is cut off so the next append stays aligned;
+    // only the holder of the writer lock may repair.
+    void refresh(bool repair);
+
+    // The record alone, without reading its message.
+    bool read(uint64_t id, Record& r) const;
+    bool read(uint64_t id, Record& r, std::string& message) const;
+
+    // A commit's hash: of its id, parent, time, tree and message, so it is
+    // the same in every repository the commit was pushed or pulled to.
+    static uint64_t hashOf(const Record& r, const std::string& message);
+
+    // A full or short commit hash: 4 to 16 lower-case hex digits.
+    static bool isHashPrefix(const std::string& s);
+
+    // The id of the commit whose hash starts with prefix: 0 if none does,
+    // -1 if more than one.
+    int64_t findHash(const std::string& prefix) const;
+
+    // Hash of record n and those 1, 2, 4, 8, ... before it (parents, times,
+    // trees and messages), so O(log n) reads. Logs only grow at the end and
+    // every record carries its own time and tree, so two logs that went
+    // apart at some record differ at every one from there on, n included:
+    // the same digest at n means the same commits up to there, whatever
+    // else each has appended since.
+    std::string digest(size_t n) const;
+
+    // Fills in the record's message offset/length and appends both; the message
+    // goes first so the index never points past the end of the messages file.
+    // Inside a batch the append is only buffered (but readable).
+    bool append(Record& r, const std::string& message);
+
+    // Appends made between beginBatch() and commitBatch() reach disk together,
+    // in one write per file; abortBatch() drops them.
+    void beginBatch() { batching = true; }
+
+    bool commitBatch();
+    void abortBatch();
+};
+
+// Git-style stat cache (.vcs/index): for every tracked path, the mtime, size
+// and inode seen when VCSim last read or wrote it, plus the content hash of
+// what it held then. A path whose stat data still matches is known to hold
+// that content without being read again.
+class StatCache {
+public:
+    struct Entry {
+        int64_t mtime = 0;   // nanoseconds
+        uint64_t size = 0;
+        uint64_t inode = 0;
+        std::string hash;
+    };
+
+private:
+    static constexpr char MAGIC[9] = "VCSSTAT1";
+    static const uint64_t SMUDGED = ~uint64_t(0);
+
+    std::string path;
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_set<std::string> touched;  // recorded or erased since the last load or save
+    Entry stamp;                              // the index file as last read or written
+    bool dirty = false;
+
+    static int64_t nowNanos();
+
+public:
+    static bool statFile(const std::string& file, Entry& e);
+
+private:
+    static bool read(const std::string& path, std::unordered_map<std::string, Entry>& out);
+
+    // Takes in what other processes saved since the last look, keeping this
+    // one's own unsaved changes over theirs.
+    void merge();
+
+public:
+    bool load(const std::string& p);
+
+    // Picks up other processes' saves; cheap when there are none.
+    void refresh() { merge(); }
+
+    // Entries modified within the last couple of seconds could change again
+    // without their mtime moving, so their size is smudged to force a rehash
+    // on the next check (the "racy clean" problem).
+    // Merges first, so the save never drops another process's entries; the
+    // caller holds the repository's writer lock.
+    bool save();
+    const Entry* find(const std::string& file) const;
+
+    // True when the file's current stat data matches its cached entry.
+    bool isUnchanged(const std::string& file, const Entry& now) const;
+    void record(const std::string& file, const Entry& now, const std::string& hash);
+
+    // Re-stats the file and records it as holding content with the given hash.
+    void refresh(const std::string& file, const std::string& hash);
+    void erase(const std::string& file);
+    std::vector<std::string> paths() const;
+};
+
+// Git-style refs. .vcs/refs/heads/<name> holds a branch's tip commit id and
+// .vcs/HEAD holds "ref: <name>" for the current branch, or a bare commit id
+// when a commit was checked out directly (detached HEAD). Between
+// beginBatch() and commitBatch() changes stay in memory, like CommitLog's.
+class Refs {
+    std::string root;
+    std::string current;           // branch HEAD points at; empty when detached
+    int detachedAt = 0;
+    std::map<std::string, int> tips;
+    bool batching = false;
+
+    static bool writeAtomic(const std::string& path, const std::string& text);
+    bool flush();
+
+public:
+    static bool validName(const std::string& name);
+
+    // latest is the newest commit in the log; a repository from before refs
+    // existed gets a "main" branch pointing at it.
+    bool open(const std::string& dir, int latest);
+
+    // Empty when HEAD is detached.
+    const std::string& branch() const { return current; }
+
+    // Commit HEAD resolves to; 0 on a branch with no commits yet.
+    int head() const;
+
+    // Tip of the named branch, or -1 if there is no such branch.
+    int tip(const std::string& name) const;
+
+    const std::map<std::string, int>& branches() const { return tips; }
+
+    bool createBranch(const std::string& name, int id);
+
+    // Moves the current branch (or the detached HEAD) to a new commit.
+    bool advance(int id);
+
+    // Puts HEAD on the branch, which then points at id.
+    bool switchTo(const std::string& name, int id);
+    bool detach(int id);
+
+    void beginBatch() { batching = true; }
+
+    bool commitBatch();
+    void abortBatch();
+};
+
+// Write-ahead record of the commit in flight, kept in .vcs/journal. A commit
+// stores its objects, writes every working file to its pending path and the
+// journal, then syncs once. Only after that does it rename the files into
+// place and append the log record and ref; a second sync makes those
+// durable and the journal is removed. A journal found on startup is replayed
+// if its checksum holds and every file it lists is on disk with the listed
+// hash, and is discarded with its pending files otherwise.
+class Journal {
+public:
+    struct Entry {
+        std::string path, blob;
+        uint64_t hash = 0;  // of the new content
+    };
+    CommitLog::Record record;
+    std::string branch;  // empty when HEAD was detached
+    std::string message;
+    std::vector<Entry> files;
+
+    // Text lines, then the XXH64 of everything before it:
+    //   VCSJRNL1 / id parent timestamp tree / branch or "-" / message length,
+    //   message / file count, then "<blob> <hash> <path>" per file / checksum
+    std::string serialize() const;
+    bool parse(const std::string& text);
+
+    bool write(const std::string& path) const { return File::writeAtomic(path, serialize()); }
+
+    bool read(const std::string& path);
+};
+
+// One path in a commit, by value: the blob it was stored as, which kind of
+// File it checks out as, and the committed bytes while this session still
+// holds them (shared with the parent commit's entry when unchanged). Each
+// directory of a tree keeps its files as a vector of these sorted by path,
+// so walking a directory is a linear pass over contiguous entries; File
+// objects are only made for the paths that get checked out.
+struct TreeEntry {
+    enum Kind : uint8_t { UNKNOWN, TEXT, BINARY };
+    // Readers sharing a tree may resolve an entry's kind at the same time.
+    struct KindSlot {
+        mutable std::atomic<Kind> value;
+        KindSlot(Kind k = UNKNOWN) : value(k) {}
+        KindSlot(const KindSlot& o) : value(o.value.load(std::memory_order_relaxed)) {}
+        KindSlot& operator=(const KindSlot& o) { value.store(o.value.load(std::memory_order_relaxed), std::memory_order_relaxed); return *this; }
+    };
+    std::string path;
+    uint64_t hash = 0;
+    KindSlot kind;  // UNKNOWN when read back from a tree object, until resolved
+    std::shared_ptr<const std::string> content;
+
+    std::string blob() const { return ContentHash::hex(hash); }
+
+    // The kind, looked up in the store (once) when the tree object did not
+    // record it, the way File::loadFromDisk decides: chunked content is
+    // binary, and so is a blob File::looksBinary flags. A blob read for that
+    // is handed to *read when given. False if the blob is missing.
+    bool resolveKind(const ObjectStore& store, Kind& out, std::string* read = nullptr) const;
+    bool contentIn(const ObjectStore& store, std::string& out) const;
+};
+
+// One directory of a commit's tree: its files, and its subdirectories by
+// name ("sub/"). Nodes are immutable once shared, so a commit copies only the
+// directories on the paths it changes and shares every other node, and the
+// tree object it was stored as, with its parent.
+struct TreeNode {
+    using Dirs = std::map<std::string, std::shared_ptr<const TreeNode>, std::less<>>;
+    mutable std::string hash;  // the stored tree object; empty until putTree writes it
+    size_t count = 0;          // files here and below
+    std::vector<TreeEntry> files;
+    Dirs dirs;
+};
+
+class Tree {
+    std::shared_ptr<const TreeNode> root;
+
+    // A node's files and subdirectories, one at a time in path order.
+    struct Cursor {
+        const TreeNode* node;
+        size_t prefix, file = 0;
+        TreeNode::Dirs::const_iterator dir;
+        Cursor(const TreeNode* n, size_t p) : node(n), prefix(p) { if (n) dir = n->dirs.begin(); }
+        bool done() const { return !node || (file == node->files.size() && dir == node->dirs.end()); }
+        std::string_view fileName() const { return std::string_view(node->files[file].path).substr(prefix); }
+        bool atDir() const { return file == node->files.size() || (dir != node->dirs.end() && std::string_view(dir->first) < fileName()); }
+        std::string_view name() const { return atDir() ? std::string_view(dir->first) : fileName(); }
+        void next() { if (atDir()) ++dir; else ++file; }
+    };
+
+    // Calls f(a, b) for each path whose entries differ under two nodes, null
+    // for the side that lacks it; subtrees stored as the same object are
+    // skipped whole.
+    template <class F>
+    static void compare(const TreeNode* a, const TreeNode* b, size_t prefix, F& f) {
+        if (a == b || (a && b && !a->hash.empty() && a->hash == b->hash)) return;
+        Cursor x(a, prefix), y(b, prefix);
+        while (!x.done() || !y.done()) {
+            int c = x.done() ? 1 : y.done() ? -1 : x.name().compare(y.name());
+            bool dir = c <= 0 ? x.atDir() : y.atDir();  // the names say which: a directory's ends in '/'
+            size_t sub = prefix + (c <= 0 ? x.name() : y.name()).size();
+            if (dir) compare(c <= 0 ? x.dir->second.get() : nullptr, c >= 0 ? y.dir->second.get() : nullptr, sub, f);
+            else {
+                const TreeEntry* ea = c <= 0 ? &x.node->files[x.file] : nullptr;
+                const TreeEntry* eb = c >= 0 ? &y.node->files[y.file] : nullptr;
+                if (!ea || !eb || ea->hash != eb->hash) f(ea, eb);
+            }
+            if (c <= 0) x.next();
+            if (c >= 0) y.next();
+        }
+    }
+
+    // A copy of old with the edits in [it, end) under dir (sorted by path)
+    // added or replacing the entries at their paths; old itself when none
+    // changes anything.
+    static std::shared_ptr<const TreeNode> apply(const std::shared_ptr<const TreeNode>& old, std::vector<TreeEntry>::iterator& it,
+                                                 std::vector<TreeEntry>::iterator end, const std::string& dir);
+
+public:
+    Tree() = default;
+    explicit Tree(std::shared_ptr<const TreeNode> r) : root(std::move(r)) {}
+
+    const std::shared_ptr<const TreeNode>& node() const { return root; }
+    size_t size() const { return root ? root->count : 0; }
+
+    const TreeEntry* lookup(const std::string& path) const;
+
+    // Every entry, in path order.
+    template <class F>
+    void forEach(F f) const {
+        auto each = [&](const TreeEntry* e, const TreeEntry*) { f(*e); };
+        compare(root.get(), nullptr, 0, each);
+    }
+
+    // f(a, b) for each path where the trees differ; see compare above.
+    template <class F>
+    static void compare(const Tree& a, const Tree& b, F f) { compare(a.root.get(), b.root.get(), 0, f); }
+
+    // This tree with edits (sorted by path) added or replacing the entries at
+    // their paths. Only the directories on their paths are copied, and the
+    // copies have no hash until putTree stores them.
+    Tree with(std::vector<TreeEntry> edits) const;
+};
+
+class Commit {
+private:
+    int id;
+    int parent;
+    std::string message;
+    time_t timestamp;
+    std::string tree;
+    std::string hash;
+    Tree entries;
+public:
+    Commit(const CommitLog::Record& r, const std::string& msg, Tree e);
+
+    // A tree object is one directory: a "<hash> <name>" line per entry, in
+    // path order, where a name ending in '/' is a subdirectory's tree.
+    // (Trees written before directories were split are one flat level of
+    // full paths, and read the same way.)
+    static bool parseTree(const std::string& text, std::map<std::string, std::string>& blobs);
+
+    // As ctime() formats it, but safe for several readers at once.
+    std::string getTimestamp() const;
+
+    // With the parent given, lists only the entries this commit changed.
+    // Text is read from the store unless the entry still holds it.
+    void showDetails(std::ostream& os, const Commit* parentCommit, const ObjectStore& store) const;
+
+    const Tree& getSnapshot() const { return entries; }
+    int getId() const { return id; }
+    int getParent() const { return parent; }
+    const std::string& getMessage() const { return message; }
+    time_t getTime() const { return timestamp; }
+    const std::string& getTree() const { return tree; }
+    const std::string& getHash() const { return hash; }
+};
+
+// .vcsignore: one pattern per line, '#' starting a comment. A pattern with a
+// '/' before its end is matched against the whole path from the repository
+// root, any other against each file and directory name; a trailing '/'
+// limits it to directories. .vcs, and files mid-write by a commit, are
+// always ignored.
+class IgnoreRules {
+    struct Rule {
+        std::string pattern;
+        bool dirOnly;
+        bool wholePath;
+    };
+    std::vector<Rule> rules;
+
+public:
+    // '*' matches any run of characters, '?' any single character.
+    static bool globMatch(const char* pattern, const char* name);
+
+    // A missing file is no rules.
+    void load(const std::string& path);
+    bool ignored(const std::string& path, const std::string& name, bool isDir) const;
+};
+
+// One side of a push or pull connection: protocol lines and sized blocks of
+// bytes over a pair of file descriptors, buffered both ways. Once a read or
+// write fails every later one does too; reading still works after a failed
+// write, so the other side's last word (usually why it hung up) gets through.
+class Wire {
+    int in, out;
+    std::string inBuf, outBuf;
+    size_t inPos = 0;
+    bool inBroken = false, outBroken = false;
+
+    bool fill();
+
+public:
+    Wire(int readFd, int writeFd) : in(readFd), out(writeFd) {}
+
+    // The next line, without its '\n'.
+    bool readLine(std::string& line);
+    bool readBytes(size_t n, std::string& data);
+
+    bool writable() const { return !outBroken; }
+
+    void send(std::string_view data);
+    bool flush();
+};
+
+// The other repository of a push or pull, reached through `vcsim --serve
+// <dir>` running there: over ssh for "host:dir" or "ssh://host/dir", as a
+// child process for a local path. VCSIM_REMOTE_VCSIM names the program to
+// run (default: vcsim on the far host, this binary locally).
+class Remote {
+    int pid = -1;
+    int readFd = -1, writeFd = -1;
+    std::unique_ptr<Wire> channel;
+public:
+    Remote() = default;
+    Remote(const Remote&) = delete;
+    Remote& operator=(const Remote&) = delete;
+    ~Remote() { close(); }
+
+    bool open(const std::string& url);
+    Wire& wire() { return *channel; }
+    // Hangs up and waits for the far side; true if it exited cleanly.
+    bool close();
+};
+
+// Filters and format for Repository::log.
+struct LogOptions {
+    size_t limit = SIZE_MAX;
+    time_t since = 0;
+    std::string grep;
+    bool oneline = false;
+};
+
+class Repository {
+    // Declared first so it outlives every pooled object below.
+    mutable MemoryPool memory;
+    CommitLog history;
+    // Commits materialized from the log (or created this session), by id,
+    // while something holds them; the one at HEAD is kept.
+    mutable std::unordered_map<int, std::weak_ptr<const Commit>> commitsById;
+    mutable std::shared_ptr<const Commit> headCommit;
+    // Directories read back from tree objects, by "<hash> <path>", while a
+    // commit holds them: commits loaded one after another share every
+    // directory neither changed.
+    mutable std::unordered_map<std::string, std::weak_ptr<const TreeNode>> treeNodes;
+    mutable size_t treeNodesPruned = 0;
+    FileSet stagedFiles;
+    int nextCommitId;
+    ObjectStore objects;
+    StatCache index;
+    Refs refs;
+    ThreadPool pool;
+
+    // Processes share the repository through files: objects and packs are
+    // immutable, and writers take repoLock. Threads share this instance
+    // through apiMutex, which every public operation holds: shared by those
+    // that only read (log, diff, status, lookups), exclusively by the rest.
+    // Public operations never call each other, as the lock is not recursive.
+    // Under a shared hold, the commit and tree caches are guarded by
+    // cacheMutex and status's index updates by indexMutex.
+    RepoLock repoLock{".vcs/lock"};
+    mutable std::shared_mutex apiMutex;
+    mutable std::mutex cacheMutex, indexMutex;
+    int writeDepth = 0;
+
+    // At most one background gc at a time; cancelled when the repository closes.
+    std::thread gcThread;
+    std::atomic<bool> gcRunning{false}, gcCancel{false};
+
+    // State to roll back to if an open transaction fails.
+    bool inTransaction = false;
+    int transactionStartId = 0;
+    // stagedFiles differs from what .vcs/staged records.
+    bool stagingChanged = false;
+
+    // Saved under the writer lock (index.save() merges what others saved).
+    // The index is only a cache, so rather than wait for another writer the
+    // save is put off to the next one.
+    void saveIndex();
+
+    // Full tree of the commit HEAD points at; empty before the first commit.
+    Tree headTree() const;
+
+    // The content hash of each path on disk; present[i] is 0 where there is
+    // no readable file. The stat cache answers without reading a file
+    // whenever its stat data is unchanged; the others are stat'ed and
+    // rehashed on the worker pool, and the cache takes the new hashes.
+    void diskHashes(const std::vector<std::string>& paths, std::vector<uint64_t>& hashes, std::vector<char>& present);
+
+    // Which of files (path, blob hash) hold that blob on disk.
+    std::vector<char> diskHolds(const std::vector<std::pair<std::string, uint64_t>>& files);
+
+    static constexpr const char* JOURNAL = ".vcs/journal";
+
+    // Brings the log and refs up to date with what other processes wrote.
+    // A writer (locked) also repairs a torn log record and finishes or
+    // discards a crashed writer's journal.
+    void catchUp(bool locked);
+
+    // Held by every change to refs, the commit log or the index; nests.
+    bool lockForWrite();
+
+    void unlockWrite() { if (--writeDepth == 0) repoLock.unlock(); }
+
+    class WriteLock {
+        Repository& repo;
+        bool held;
+    public:
+        explicit WriteLock(Repository& r) : repo(r), held(r.lockForWrite()) {}
+        WriteLock(const WriteLock&) = delete;
+        WriteLock& operator=(const WriteLock&) = delete;
+        ~WriteLock() { if (held) repo.unlockWrite(); }
+        explicit operator bool() const { return held; }
+    };
+
+    // Stores a file's staged content: a chunk at a time when it is not in
+    // memory, else whole or as a line delta against base.
+    std::string storeStaged(const File& f, const std::string& base);
+
+    static constexpr const char* STAGED = ".vcs/staged";
+
+    // The staging area outlives the process, so `vcsim add` and `vcsim
+    // commit` may be separate runs: the staged content goes into the store
+    // and .vcs/staged names a tree of it, which gc keeps like a commit's.
+    // Saved under the writer lock.
+    bool saveStaging();
+
+    // The blobs .vcs/staged names, by path; false if it names none.
+    bool readStaging(std::map<std::string, std::string>& blobs) const;
+
+    // Restages what .vcs/staged holds, each file over HEAD's version as add
+    // would; content HEAD already has is no longer a change.
+    void loadStaging();
+    static bool holdsHash(const std::string& path, uint64_t hash);
+    static void removePending(const std::vector<Journal::Entry>& files);
+
+    // Finishes, or else discards, a commit that a crash interrupted.
+    void recoverJournal();
+    static size_t workerCount();
+
+    // gc roots: every commit's tree with its parent's tree, read from the log
+    // on the calling thread so that a background gc never touches history.
+    std::vector<std::pair<std::string, std::string>> gcRoots() const;
+
+    // Marks every object the roots reach (trees, blobs, their chunks and delta bases)
+    // and plans a delta retry for each changed blob against its path's
+    // previous revision, skipping blobs that stored deltas are built on
+    // (their recorded chain depths would go stale). False if a tree is
+    // unreadable, since then nothing may be pruned.
+    bool planGc(const std::vector<std::pair<std::string, std::string>>& roots, std::unordered_set<uint64_t>& live, ObjectStore::RepackPlan& plan) const;
+    static size_t gcSetting(const char* name, size_t fallback);
+
+    // VCSIM_GC_AUTO estimated loose objects (0 turns automatic gc off) or
+    // more than VCSIM_GC_AUTO_PACKS packs.
+    bool gcWanted() const;
+
+    // A full gc merges every pack and drops everything unreachable; otherwise
+    // loose objects go into a new pack (packs are merged only once there are
+    // too many) and nothing is deleted: the background gc runs without the
+    // writer lock, so another process may be about to reference any object.
+    bool runGc(const std::vector<std::pair<std::string, std::string>>& roots, bool full, ObjectStore::RepackResult& result);
+    static void lowerThreadPriority();
+
+    void finishBackgroundGc() { if (gcThread.joinable()) gcThread.join(); }
+
+    Repository();
+    ~Repository();
+
+    // Reads a tree and its subtrees into full path -> blob; trees, if given,
+    // collects every tree object read.
+    bool readTree(const std::string& hash, std::map<std::string, std::string>& blobs, std::vector<std::string>* trees = nullptr,
+                  const std::string& prefix = "") const;
+
+    // Writes the tree objects of node and its subdirectories that are not
+    // stored yet, subdirectories first; a node shared with the parent commit
+    // already is. Returns node's tree, "" if a write failed.
+    std::string putTree(const TreeNode& node);
+
+    // A working File for a committed entry, of the entry's kind; null if its
+    // blob is missing from the store.
+    std::shared_ptr<File> fileFor(const TreeEntry& e) const;
+
+    template <class T>
+    std::shared_ptr<File> makeFile(const TreeEntry& e) const {
+        if (e.content) return memory.make<T>(e.path, e.content, e.hash);
+        return memory.make<T>(e.path, memory.make<StoredBlob>(objects, e.blob()), e.hash);
+    }
+
+    // The directory stored as tree object hash at prefix, shared with any
+    // commit already holding it; its blobs are read only when something asks
+    // for their content.
+    std::shared_ptr<const TreeNode> loadNode(const std::string& hash, const std::string& prefix) const;
+
+    // Rebuilds a commit from its log record and tree objects.
+    std::shared_ptr<const Commit> loadCommit(int commitId) const;
+
+    // The cached commit, else one loaded for the caller alone, so a walk
+    // over history holds only the commits it is looking at.
+    std::shared_ptr<const Commit> peekCommit(int commitId) const;
+
+    // The commit, loaded once while anything holds it.
+    std::shared_ptr<const Commit> commitAt(int commitId) const;
+
+    // Push and pull. The side receiving commits speaks first: the length
+    // and digest of its log, and where it has the branch. The sender, whose
+    // log must extend that one (ids are log positions, so diverged logs
+    // cannot be joined), lists every object its newer commits reach that
+    // their ancestors on the other side do not. The receiver names the ones
+    // it lacks, and the sender streams just those, as stored (compressed,
+    // deltas still deltas against bases the receiver has), then the new
+    // commit records and its branch tip. The receiver checks every object
+    // it got before recording anything, and answers "ok" or "error <why>".
+    struct SyncResult {
+        size_t commits = 0, objects = 0;
+        uint64_t bytes = 0;
+        int tip = 0;
+    };
+
+    static bool parseCount(const std::string& line, const std::string& word, size_t& n);
+    static bool isObjectName(const std::string& s);
+
+    // Whether ancestor is reached from id by following parents.
+    bool isAncestor(int ancestor, int id) const;
+
+    // Adds to out every object reachable from tree that seen does not hold
+    // yet, and the delta bases and chunks each is stored with; with out null
+    // they are only marked seen.
+    bool reach(const std::string& tree, std::unordered_set<std::string>& seen, std::vector<std::string>* out) const;
+
+    // The sending half: returns "" or why it failed.
+    std::string sendUpdates(Wire& w, const std::string& branch, SyncResult& result);
+
+    // The receiving half, under the writer lock throughout. Moves branch to
+    // the sender's tip unless moveBranch is false (result.tip says where).
+    std::string receiveUpdates(Wire& w, const std::string& branch, bool moveBranch, SyncResult& result);
+
+    // Objects sent are held in a quarantine beside the store until all of
+    // them verify, so a rejected push leaves nothing behind that a retry or
+    // a local put() could take for an intact copy.
+    std::string receive(Wire& w, const std::string& branch, bool moveBranch, SyncResult& result);
+    std::string receiveInto(Wire& w, const std::string& branch, bool moveBranch, SyncResult& result, ObjectStore& incoming);
+
+public:
+    static Repository& getInstance();
+
+    // Catches up with other processes' commits and ref changes; cheap, so it
+    // runs before every command.
+    void refresh();
+    void addFile(const std::shared_ptr<File>& f, bool announce = true);
+
+    // Saves the staging area for later commands, unless a transaction is
+    // open (its end saves it) or nothing changed.
+    void keepStaging();
+
+private:
+    // For callers already holding apiMutex, as commit() does.
+    void keepStagingLocked();
+
+public:
+
+    // Commits made until endTransaction() only become part of the on-disk
+    // history (and index) if the transaction ends successfully. The writer
+    // lock is held throughout; false if it could not be taken.
+    bool beginTransaction();
+    bool endTransaction(bool success);
+    bool commit(const std::string& msg);
+
+    // Follows parent links back from HEAD, straight off the commit log: filters
+    // look only at the log record and message, and commits (with their file
+    // contents) are loaded only for the full format. Output is flushed in
+    // large blocks.
+    void log(const LogOptions& opts = LogOptions()) const;
+    std::shared_ptr<const Commit> findCommit(int commitId) const;
+
+    // Loads the target commit's tree and rewrites, in parallel, only the paths
+    // whose blob is not already on disk (or that carry unstaged edits); force
+    // rewrites every file. Clean files tracked at the old HEAD but absent from
+    // the target are removed. With a branch name HEAD follows that branch,
+    // otherwise it is detached at the commit.
+    // Only reads until the files are written; the writer lock covers moving
+    // HEAD and saving the index.
+    bool checkout(int commitId, FileSet& workingFiles, bool force = false, const std::string& branch = "");
+
+private:
+    // For callers already holding apiMutex, as pull() does.
+    bool checkoutLocked(int commitId, FileSet& workingFiles, bool force, const std::string& branch);
+
+public:
+    // Tip of the named branch, or -1 if there is none.
+    int branchTip(const std::string& name) const;
+
+    // The commit a full or short hash names: 0 if none, -1 if several.
+    int commitByHash(const std::string& prefix) const;
+    bool createBranch(const std::string& name, int at);
+    int head() const;
+
+    // Sends branch's new commits and the objects they need to url.
+    bool push(const std::string& url, const std::string& branch);
+
+    // Fetches url's new commits on branch and the objects they need. When
+    // branch is the current one, the working files follow it.
+    bool pull(const std::string& url, const std::string& branch, FileSet& workingFiles);
+
+    // The far end of a push or pull (`vcsim --serve <dir>`), talking over w.
+    // Its working files are left alone.
+    bool serve(Wire& w);
+    void listBranches() const;
+
+    // Unified diff between two commits. Only paths whose blob hashes differ
+    // in the two snapshots are diffed at all.
+    bool diff(int fromId, int toId) const;
+
+    // Packs and prunes in the foreground, after any background gc finishes.
+    // autoOnly runs an incremental pass, and only when one is due.
+    void gc(bool autoOnly = false);
+
+    // Starts an incremental gc on a low-priority thread when one is due and
+    // none is running. Meant for interactive sessions, after a commit.
+    void backgroundGc();
+
+    // The files under dir ("" for the whole working tree) that ignore lets
+    // through, sorted. Each level of directories is listed in parallel;
+    // symlinked directories are not followed.
+    std::vector<std::string> walk(const std::string& dir, const IgnoreRules& ignore);
+
+    // Reads each path from disk unless its stat data shows it still holds
+    // the content recorded in the index, in parallel. loaded[i] is set only
+    // when the file differs from what was recorded (or was never recorded),
+    // and already carries its content hash.
+    void readChanged(const std::vector<std::string>& paths, std::vector<std::shared_ptr<File>>& loaded);
+    bool readIfChanged(const std::string& path, std::shared_ptr<File>& loaded);
+
+    // A copy of HEAD's file at path, content unloaded until read, or null if
+    // HEAD does not track it (or, given blob, holds other content).
+    std::shared_ptr<File> committedFile(const std::string& path, const std::string& blob = "") const;
+    void recordOnDisk(const std::shared_ptr<File>& f);
+
+    // Reports staged edits, and files whose disk content differs from what
+    // is staged for them or, when nothing is, from HEAD. The index only
+    // spares reading files whose stat data is unchanged.
+    void status(const FileSet& workingFiles);
+
+    friend class VCS;
+};
+
+class VCS {
+    FileSet workingFiles;
+    Repository& repo;
+    std::istream* input;  // where prompts and edit content are read from
+    bool interactive;     // false: never prompt, missing files are errors
+public:
+    // Files an earlier command staged are working files again.
+    explicit VCS(std::istream& in = std::cin, bool inter = true);
+
+    // Returns false if the command failed.
+    bool runCommand(const std::string& cmd);
+
+    // Runs a script (one command per line; the line after "edit <file>" is the
+    // new content; blank lines and '#' comments are skipped) without any
+    // prompts and as one transaction: the script is checked up front, and its
+    // commits and index updates are written only if every command succeeds.
+    // A single command (`vcsim <command words>`) runs the same way, but its
+    // failures are reported as its own rather than a batch's.
+    bool runBatch(const std::vector<std::string>& lines, bool single = false);
+    static bool isBlankOrComment(const std::string& line);
+
+    // Static checks for one batch line: known command, arguments present,
+    // paths and globs resolve, edits followed by their content line.
+    static std::string checkBatchLine(const std::vector<std::string>& lines, size_t i);
+    static bool parseId(const std::string& s, int& id);
+
+    // stats: table of counters; --json: the same as JSON; --reset: zero them;
+    // --trace <file>: write the recorded trace events (needs VCSIM_TRACE).
+    bool showStats(const std::vector<std::string>& args);
+
+    // A commit id, a branch name with at least one commit, or a full or
+    // short commit hash (one of digits only is read as an id).
+    bool resolve(const std::string& rev, int& id) const;
+
+    // The commit a full or short hash names, 0 if none; -1, and says so, if
+    // the prefix fits several.
+    int commitByHash(const std::string& rev) const;
+
+    static bool hasWildcard(const std::string& s) { return s.find_first_of("*?") != std::string::npos; }
+
+    // The path as the repository names it: '/'-separated, no "./" or
+    // trailing '/', and "" for the working tree root.
+    static std::string normalPath(const std::string& arg);
+
+    // Expands wildcards in the last path component against the files in that
+    // directory, sorted by name.
+    static std::vector<std::string> expandGlob(const std::string& pattern);
+    bool addPath(const std::string& fname);
+
+    // Adds every file under dir that .vcsignore does not exclude, reading
+    // only those whose stat data changed, several at a time.
+    bool addDirectory(const std::string& dir);
+
+    // Stages fname, given what readChanged loaded for it (null: its content
+    // is still what the index records, or it is missing). Whether that is a
+    // change is decided against HEAD's version alone. A single add
+    // announces the file and may offer to create it. Returns the staged
+    // file, or null.
+    std::shared_ptr<File> stagePath(const std::string& fname, std::shared_ptr<File> loaded, bool single);
+
+    // Splits on whitespace; double quotes group words into one argument.
+    static std::vector<std::string> splitArgs(const std::string& s);
+
+    // Digits only, and false rather than a wrapped value if n overflows.
+    template <typename T>
+    static bool parseNumber(const std::string& s, T& n) {
+        if (s.empty() || !std::all_of(s.begin(), s.end(), ::isdigit)) return false;
+        auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+        return ec == std::errc() && end == s.data() + s.size();
+    }
+
+    static bool parseDate(const std::string& s, time_t& out);
+    bool editFile(const std::shared_ptr<File>& f);
+    void showWorkingFiles();
+};
@@ -0,0 +1,162 @@
+#include "Vcs_oops.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+bool Wire::fill() {
+    if (inPos > 0) {
+        inBuf.erase(0, inPos);
+        inPos = 0;
+    }
+#ifndef _WIN32
+    char buf[1 << 16];
+    ssize_t n;
+    do n = ::read(in, buf, sizeof buf); while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        inBuf.append(buf, size_t(n));
+        return true;
+    }
+#endif
+    inBroken = true;
+    return false;
+}
+
+bool Wire::readLine(string& line) {
+    size_t nl;
+    while ((nl = inBuf.find('\n', inPos)) == string::npos) {
+        if (inBroken || inBuf.size() - inPos > (1 << 20) || !fill()) return false;
+    }
+    line.assign(inBuf, inPos, nl - inPos);
+    inPos = nl + 1;
+    return true;
+}
+
+bool Wire::readBytes(size_t n, string& data) {
+    while (inBuf.size() - inPos < n) {
+        if (inBroken || !fill()) return false;
+    }
+    data.assign(inBuf, inPos, n);
+    inPos += n;
+    return true;
+}
+
+void Wire::send(string_view data) {
+    outBuf.append(data.data(), data.size());
+    if (outBuf.size() >= (1 << 16)) flush();
+}
+
+bool Wire::flush() {
+#ifndef _WIN32
+    for (size_t done = 0; done < outBuf.size() && !outBroken;) {
+        ssize_t n = ::write(out, outBuf.data() + done, outBuf.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) outBroken = true;
+        else done += size_t(n);
+    }
+#else
+    outBroken = true;
+#endif
+    outBuf.clear();
+    return !outBroken;
+}
+
+// The url's far end as an argument vector, or none for a host ssh would
+// read as an option; for ssh the path is quoted, since the far shell sees
+// the command as one line.
+static vector<string> serveCommand(const string& url) {
+    const char* program = getenv("VCSIM_REMOTE_VCSIM");
+    string host, dir = url;
+    if (url.rfind("ssh://", 0) == 0) {
+        size_t slash = url.find('/', 6);
+        host = url.substr(6, slash == string::npos ? string::npos : slash - 6);
+        dir = slash == string::npos ? "." : url.substr(slash);
+    } else {
+        // "c:\\dir" is a path, not a host called c.
+        size_t colon = url.find(':');
+        if (colon != string::npos && colon > 1 && url.find('/') > colon) {
+            host = url.substr(0, colon);
+            dir = url.substr(colon + 1);
+        }
+    }
+    if (dir.empty()) dir = ".";
+    if (host.empty()) {
+        error_code ec;
+        fs::path self = fs::read_symlink("/proc/self/exe", ec);
+        return {program ? program : ec ? "vcsim" : self.string(), "--serve", dir};
+    }
+    // ssh would take a host like "-oProxyCommand=..." for an option.
+    if (host[0] == '-') return {};
+    string quoted = "'";
+    for (char c : dir) quoted += c == '\'' ? string("'\\''") : string(1, c);
+    return {"ssh", "--", host, program ? program : "vcsim", "--serve", quoted + "'"};
+}
+
+bool Remote::open(const string& url) {
+#ifndef _WIN32
+    vector<string> args = serveCommand(url);
+    if (args.empty()) {
+        cout << "Not a host name: " << url << endl;
+        return false;
+    }
+    vector<char*> argv;
+    for (string& a : args) argv.push_back(&a[0]);
+    argv.push_back(nullptr);
+    string cannotRun = "Cannot run " + args[0] + "\n";  // built before fork: the child may only exec or write
+    int toChild[2], fromChild[2];
+    if (::pipe(toChild) != 0) return false;
+    if (::pipe(fromChild) != 0) {
+        ::close(toChild[0]);
+        ::close(toChild[1]);
+        return false;
+    }
+    // A dropped connection shows up as a failed write, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+    pid = int(::fork());
+    if (pid == 0) {
+        ::dup2(toChild[0], 0);
+        ::dup2(fromChild[1], 1);
+        ::close(toChild[0]);
+        ::close(toChild[1]);
+        ::close(fromChild[0]);
+        ::close(fromChild[1]);
+        ::execvp(argv[0], argv.data());
+        ssize_t unused = ::write(2, cannotRun.data(), cannotRun.size());
+        (void)unused;
+        _exit(127);
+    }
+    ::close(toChild[0]);
+    ::close(fromChild[1]);
+    readFd = fromChild[0];
+    writeFd = toChild[1];
+    if (pid < 0) {
+        close();
+        return false;
+    }
+    channel = make_unique<Wire>(readFd, writeFd);
+    return true;
+#else
+    (void)url;
+    return false;
+#endif
+}
+
+bool Remote::close() {
+#ifndef _WIN32
+    if (writeFd >= 0) ::close(writeFd);
+    if (readFd >= 0) ::close(readFd);
+    readFd = writeFd = -1;
+    if (pid <= 0) return false;
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    pid = -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#else
+    return false;
+#endif
+}
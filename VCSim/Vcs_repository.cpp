@@ -0,0 +1,1336 @@
+#include "Vcs_oops.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+void Repository::saveIndex() {
+    if (inTransaction) return;
+    if (writeDepth > 0) { index.save(); return; }
+    if (!repoLock.lock(false)) return;
+    index.save();
+    repoLock.unlock();
+}
+
+Tree Repository::headTree() const {
+    shared_ptr<const Commit> c = refs.head() ? commitAt(refs.head()) : nullptr;
+    return c ? c->getSnapshot() : Tree();
+}
+
+void Repository::diskHashes(const vector<string>& paths, vector<uint64_t>& hashes, vector<char>& present) {
+    hashes.assign(paths.size(), 0);
+    present.assign(paths.size(), 0);
+    vector<char> reread(paths.size(), 0);
+    vector<StatCache::Entry> now(paths.size());
+    pool.parallelFor(paths.size(), [&](size_t i) {
+        if (!StatCache::statFile(paths[i], now[i])) return;
+        if (index.isUnchanged(paths[i], now[i])) {
+            hashes[i] = PackFile::parseHash(index.find(paths[i])->hash);
+            present[i] = 1;
+        } else if (File::hashOnDisk(paths[i], hashes[i])) {
+            present[i] = reread[i] = 1;
+        }
+    });
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (reread[i]) index.record(paths[i], now[i], ContentHash::hex(hashes[i]));
+    }
+}
+
+vector<char> Repository::diskHolds(const vector<pair<string, uint64_t>>& files) {
+    vector<string> paths;
+    for (const auto& f : files) paths.push_back(f.first);
+    vector<uint64_t> hashes;
+    vector<char> present, holds(files.size(), 0);
+    diskHashes(paths, hashes, present);
+    for (size_t i = 0; i < files.size(); ++i) holds[i] = present[i] && hashes[i] == files[i].second;
+    return holds;
+}
+
+void Repository::catchUp(bool locked) {
+    if (inTransaction) return;
+    history.refresh(locked);
+    refs.open(".vcs", int(history.size()));
+    index.refresh();
+    if (locked) recoverJournal();
+    nextCommitId = int(history.size()) + 1;
+}
+
+bool Repository::lockForWrite() {
+    if (writeDepth == 0) {
+        if (!repoLock.lock()) {
+            cout << "Another process is writing to this repository; gave up waiting for .vcs/lock." << endl;
+            return false;
+        }
+        catchUp(true);
+    }
+    ++writeDepth;
+    return true;
+}
+
+string Repository::storeStaged(const File& f, const string& base) {
+    string hash = ContentHash::hex(f.getStagedHash());
+    if (!f.stagedInMemory()) return objects.putChunked([&](const auto& sink) { return f.streamStaged(sink); }, hash);
+    const string& data = f.getStagedContent();
+    return base.empty() ? objects.put(data, hash) : objects.putDelta(data, base, hash);
+}
+
+bool Repository::saveStaging() {
+    vector<File*> files;
+    for (const auto& f : stagedFiles) {
+        if (f->isModified()) files.push_back(f.get());
+    }
+    error_code ec;
+    if (files.empty()) {
+        fs::remove(STAGED, ec);
+        return !ec;
+    }
+    size_t n = files.size();
+    vector<string> bases(n), blobs(n);
+    vector<char> text(n);
+    {
+        Tree tree = headTree();
+        for (size_t i = 0; i < n; ++i) {
+            text[i] = dynamic_cast<TextFile*>(files[i]) != nullptr;
+            const TreeEntry* e = tree.lookup(files[i]->getName());
+            if (e && text[i]) bases[i] = e->blob();
+        }
+    }
+    atomic<bool> failed(false);
+    pool.parallelFor(n, [&](size_t i) {
+        blobs[i] = storeStaged(*files[i], bases[i]);
+        if (blobs[i].empty()) failed = true;
+    });
+    if (failed) return false;
+    vector<TreeEntry> entries;
+    for (size_t i = 0; i < n; ++i) {
+        entries.push_back(TreeEntry{files[i]->getName(), PackFile::parseHash(blobs[i]),
+                                    text[i] ? TreeEntry::TEXT : TreeEntry::BINARY, nullptr});
+    }
+    sort(entries.begin(), entries.end(), [](const TreeEntry& x, const TreeEntry& y) { return x.path < y.path; });
+    string tree = putTree(*Tree().with(move(entries)).node());
+    string tmp = string(STAGED) + ".tmp";
+    {
+        ofstream out(tmp, ios::binary);
+        out << tree << "\n";
+        if (tree.empty() || !out.flush()) return false;
+    }
+    fs::rename(tmp, STAGED, ec);
+    return !ec;
+}
+
+bool Repository::readStaging(map<string, string>& blobs) const {
+    ifstream in(STAGED);
+    string tree;
+    return in >> tree && readTree(tree, blobs);
+}
+
+void Repository::loadStaging() {
+    map<string, string> blobs;
+    if (!fs::exists(STAGED)) return;
+    if (!readStaging(blobs)) {
+        cout << "Warning: .vcs/staged is unreadable; add the files again." << endl;
+        return;
+    }
+    for (const auto& p : blobs) {
+        shared_ptr<File> stored = fileFor(TreeEntry{p.first, PackFile::parseHash(p.second), TreeEntry::UNKNOWN, nullptr});
+        if (!stored) continue;
+        shared_ptr<File> f = committedFile(p.first);
+        if (f) {
+            f->stageFrom(*stored);
+        } else {
+            f = move(stored);
+            f->markModified();
+        }
+        if (f->isModified()) stagedFiles.insert(f);
+    }
+}
+
+bool Repository::holdsHash(const string& path, uint64_t hash) {
+    shared_ptr<File> f = File::loadFromDisk(path);
+    return f && f->getContentHash() == hash;
+}
+
+void Repository::removePending(const vector<Journal::Entry>& files) {
+    error_code ec;
+    for (const auto& e : files) fs::remove(File::pendingPath(e.path), ec);
+}
+
+void Repository::recoverJournal() {
+    if (!fs::exists(JOURNAL)) return;
+    Journal j;
+    bool complete = j.read(JOURNAL) && objects.has(j.record.tree) && j.record.id <= history.size() + 1;
+    for (size_t i = 0; complete && i < j.files.size(); ++i) {
+        const Journal::Entry& e = j.files[i];
+        complete = objects.has(e.blob) && (holdsHash(File::pendingPath(e.path), e.hash) || holdsHash(e.path, e.hash));
+    }
+    error_code ec;
+    if (!complete) {
+        removePending(j.files);
+        fs::remove(JOURNAL, ec);
+        cout << "Warning: discarded an interrupted commit; its files and history were left as they were." << endl;
+        return;
+    }
+    for (const auto& e : j.files) {
+        if (fs::exists(File::pendingPath(e.path))) fs::rename(File::pendingPath(e.path), e.path, ec);
+        index.refresh(e.path, e.blob);
+    }
+    if (j.record.id == history.size() + 1 && !history.append(j.record, j.message)) {
+        cout << "Warning: could not replay the interrupted commit " << j.record.id << "; .vcs/journal was kept." << endl;
+        return;
+    }
+    if (refs.branch() == j.branch && refs.head() == int(j.record.parent)) refs.advance(int(j.record.id));
+    index.save();
+    if (Sync::all(".")) fs::remove(JOURNAL, ec);
+    cout << "Recovered interrupted commit " << j.record.id << " from .vcs/journal." << endl;
+}
+
+size_t Repository::workerCount() {
+    const char* n = getenv("VCSIM_THREADS");
+    return n && atoi(n) > 0 ? size_t(atoi(n)) : thread::hardware_concurrency();
+}
+
+vector<pair<string, string>> Repository::gcRoots() const {
+    vector<pair<string, string>> roots;
+    roots.reserve(history.size());
+    for (size_t id = 1; id <= history.size(); ++id) {
+        CommitLog::Record r, p;
+        if (!history.read(id, r)) continue;
+        roots.emplace_back(r.tree, r.parent && history.read(r.parent, p) ? p.tree : "");
+    }
+    ifstream staged(STAGED);
+    string tree;
+    if (staged >> tree) roots.emplace_back(tree, "");
+    return roots;
+}
+
+bool Repository::planGc(const vector<pair<string, string>>& roots, unordered_set<uint64_t>& live, ObjectStore::RepackPlan& plan) const {
+    unordered_set<string> deltaBases;
+    auto mark = [&](const string& hash) {
+        for (string h = hash; !h.empty() && live.insert(PackFile::parseHash(h)).second;) {
+            char kind;
+            string base;
+            if (!objects.peek(h, kind, base)) break;
+            if (kind == 'C') {
+                for (const string& c : objects.chunksOf(h)) live.insert(PackFile::parseHash(c));
+            }
+            if (!base.empty()) deltaBases.insert(base);
+            h = base;
+        }
+    };
+    vector<pair<string, string>> candidates;
+    string lastTree;
+    map<string, string> last, blobs, parentBlobs;
+    vector<string> trees;
+    for (const auto& r : roots) {
+        blobs.clear();
+        trees.clear();
+        if (!readTree(r.first, blobs, &trees)) return false;
+        for (const string& t : trees) mark(t);
+        for (const auto& b : blobs) mark(b.second);
+        // History is mostly linear, so the parent is usually the tree just read.
+        const map<string, string>* parent = &last;
+        if (r.second.empty()) parent = nullptr;
+        else if (r.second != lastTree) {
+            parentBlobs.clear();
+            if (!readTree(r.second, parentBlobs)) return false;
+            parent = &parentBlobs;
+        }
+        for (const auto& b : blobs) {
+            auto it = parent ? parent->find(b.first) : blobs.end();
+            if (parent && it != parent->end() && it->second != b.second) candidates.emplace_back(b.second, it->second);
+        }
+        lastTree = r.first;
+        last.swap(blobs);
+    }
+    for (auto& c : candidates) if (!deltaBases.count(c.first)) plan.deltas.push_back(move(c));
+    plan.live = &live;
+    return true;
+}
+
+size_t Repository::gcSetting(const char* name, size_t fallback) {
+    const char* v = getenv(name);
+    return v ? size_t(atol(v)) : fallback;
+}
+
+bool Repository::gcWanted() const {
+    size_t loose = gcSetting("VCSIM_GC_AUTO", 1024);
+    return loose && (objects.estimateLoose() >= loose || objects.packCount() > gcSetting("VCSIM_GC_AUTO_PACKS", 16));
+}
+
+bool Repository::runGc(const vector<pair<string, string>>& roots, bool full, ObjectStore::RepackResult& result) {
+    VCSIM_TIMED(GC);
+    unordered_set<uint64_t> live;
+    ObjectStore::RepackPlan plan;
+    if (!planGc(roots, live, plan)) return false;
+    auto now = fs::file_time_type::clock::now();
+    plan.mergePacks = full || objects.packCount() > gcSetting("VCSIM_GC_AUTO_PACKS", 16);
+    plan.prunePacked = full;
+    plan.pruneBefore = full ? now : fs::file_time_type::min();
+    plan.cancel = &gcCancel;
+    return objects.repack(plan, result);
+}
+
+void Repository::lowerThreadPriority() {
+#ifdef __linux__
+    setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), 19);
+#endif
+}
+
+Repository::Repository() : nextCommitId(1), objects(".vcs/objects"), pool(workerCount()) {
+    Stats::get();  // constructed first, so it outlives a background gc
+    if (const char* depth = getenv("VCSIM_DELTA_DEPTH")) objects.setMaxDeltaDepth(atoi(depth));
+    if (const char* name = getenv("VCSIM_CODEC")) {
+        const Codec* c = Codec::byName(name);
+        if (!c) cout << "Warning: unknown or unavailable codec '" << name << "'; using " << objects.getCodec()->name() << "." << endl;
+        objects.setCodec(c);
+    }
+    if (!history.open(".vcs")) cout << "Warning: could not open .vcs/commits.idx; history will not be saved." << endl;
+    if (!refs.open(".vcs", int(history.size()))) cout << "Warning: could not write .vcs/HEAD; branches will not be saved." << endl;
+    if (!index.load(".vcs/index")) cout << "Warning: .vcs/index is unreadable; it will be rebuilt." << endl;
+    // Repairs are a writer's job, skipped while another process is one.
+    if (repoLock.lock(false)) {
+        catchUp(true);
+        repoLock.unlock();
+    }
+    nextCommitId = int(history.size()) + 1;
+    loadStaging();
+}
+
+Repository::~Repository() {
+    gcCancel = true;
+    finishBackgroundGc();
+}
+
+bool Repository::readTree(const string& hash, map<string, string>& blobs, vector<string>* trees,
+                          const string& prefix) const {
+    string text;
+    map<string, string> level;
+    if (!objects.get(hash, text) || !Commit::parseTree(text, level)) return false;
+    if (trees) trees->push_back(hash);
+    for (auto& p : level) {
+        if (p.first.back() != '/') blobs.emplace_hint(blobs.end(), prefix + p.first, move(p.second));
+        else if (!readTree(p.second, blobs, trees, prefix + p.first)) return false;
+    }
+    return true;
+}
+
+string Repository::putTree(const TreeNode& node) {
+    if (!node.hash.empty()) return node.hash;
+    string text;
+    auto d = node.dirs.begin();
+    auto putDir = [&]() {
+        string sub = putTree(*d->second);
+        text += sub + " " + d->first + "\n";
+        ++d;
+        return !sub.empty();
+    };
+    for (const TreeEntry& e : node.files) {
+        string_view name = string_view(e.path).substr(e.path.rfind('/') + 1);
+        while (d != node.dirs.end() && string_view(d->first) < name) if (!putDir()) return "";
+        text += e.blob() + " ";
+        text += name;
+        text += "\n";
+    }
+    while (d != node.dirs.end()) if (!putDir()) return "";
+    node.hash = objects.put(text);
+    return node.hash;
+}
+
+shared_ptr<File> Repository::fileFor(const TreeEntry& e) const {
+    TreeEntry::Kind kind;
+    if (!e.resolveKind(objects, kind)) return nullptr;
+    return kind == TreeEntry::BINARY ? makeFile<BinaryFile>(e) : makeFile<TextFile>(e);
+}
+
+shared_ptr<const TreeNode> Repository::loadNode(const string& hash, const string& prefix) const {
+    string key = hash + " " + prefix;
+    {
+        lock_guard<mutex> cache(cacheMutex);
+        auto cached = treeNodes.find(key);
+        if (cached != treeNodes.end()) {
+            if (shared_ptr<const TreeNode> n = cached->second.lock()) return n;
+        }
+    }
+    string text;
+    map<string, string> level;
+    if (!objects.get(hash, text) || !Commit::parseTree(text, level)) return nullptr;
+    auto n = make_shared<TreeNode>();
+    for (auto& p : level) {
+        if (p.first.back() != '/') {
+            n->files.push_back(TreeEntry{prefix + p.first, PackFile::parseHash(p.second), TreeEntry::UNKNOWN, nullptr});
+            continue;
+        }
+        shared_ptr<const TreeNode> sub = loadNode(p.second, prefix + p.first);
+        if (!sub) return nullptr;
+        n->count += sub->count;
+        n->dirs.emplace(p.first, move(sub));
+    }
+    n->count += n->files.size();
+    shared_ptr<const TreeNode> node = n;
+    // Trees written before directories were split are one flat level of
+    // full paths, split into directories here.
+    if (prefix.empty() && any_of(n->files.begin(), n->files.end(), [](const TreeEntry& e) { return e.path.find('/') != string::npos; })) {
+        vector<TreeEntry> entries;
+        Tree(node).forEach([&](const TreeEntry& e) { entries.push_back(e); });
+        node = Tree().with(move(entries)).node();
+    }
+    node->hash = hash;
+    lock_guard<mutex> cache(cacheMutex);
+    if (treeNodes.size() >= 2 * treeNodesPruned + 1024) {
+        for (auto it = treeNodes.begin(); it != treeNodes.end();) it = it->second.expired() ? treeNodes.erase(it) : next(it);
+        treeNodesPruned = treeNodes.size();
+    }
+    treeNodes[key] = node;
+    return node;
+}
+
+shared_ptr<const Commit> Repository::loadCommit(int commitId) const {
+    CommitLog::Record r;
+    string message;
+    if (!history.read(commitId, r, message)) return nullptr;
+    shared_ptr<const TreeNode> root = loadNode(r.tree, "");
+    if (!root) return nullptr;
+    return memory.make<Commit>(r, message, Tree(move(root)));
+}
+
+shared_ptr<const Commit> Repository::peekCommit(int commitId) const {
+    {
+        lock_guard<mutex> cache(cacheMutex);
+        if (headCommit && headCommit->getId() == commitId) return headCommit;
+        auto it = commitsById.find(commitId);
+        if (shared_ptr<const Commit> c = it != commitsById.end() ? it->second.lock() : nullptr) return c;
+    }
+    return loadCommit(commitId);
+}
+
+shared_ptr<const Commit> Repository::commitAt(int commitId) const {
+    shared_ptr<const Commit> c = peekCommit(commitId);
+    if (!c) return nullptr;
+    lock_guard<mutex> cache(cacheMutex);
+    commitsById[commitId] = c;
+    if (commitId == refs.head()) headCommit = c;
+    return c;
+}
+
+bool Repository::parseCount(const string& line, const string& word, size_t& n) {
+    if (line.compare(0, word.size() + 1, word + " ") != 0 || line.size() == word.size() + 1) return false;
+    string digits = line.substr(word.size() + 1);
+    if (digits.size() > 12 || !all_of(digits.begin(), digits.end(), ::isdigit)) return false;
+    n = size_t(stoull(digits));
+    return true;
+}
+
+bool Repository::isObjectName(const string& s) {
+    return s.size() == 16 && all_of(s.begin(), s.end(), [](char c) { return isxdigit((unsigned char)c); });
+}
+
+bool Repository::isAncestor(int ancestor, int id) const {
+    CommitLog::Record r;
+    while (id > ancestor && history.read(id, r)) id = int(r.parent) < id ? int(r.parent) : 0;
+    return id == ancestor;
+}
+
+bool Repository::reach(const string& tree, unordered_set<string>& seen, vector<string>* out) const {
+    auto add = [&](const string& hash) {
+        if (!seen.insert(hash).second || !out) return true;
+        out->push_back(hash);
+        for (string h = hash;;) {
+            char kind;
+            string base;
+            if (!objects.peek(h, kind, base)) return false;
+            if (kind == 'C') {
+                for (const string& c : objects.chunksOf(h)) if (seen.insert(c).second) out->push_back(c);
+            }
+            if (base.empty() || !seen.insert(base).second) return true;
+            out->push_back(base);
+            h = base;
+        }
+    };
+    if (seen.count(tree)) return true;
+    string text;
+    map<string, string> level;
+    if (!objects.get(tree, text) || !Commit::parseTree(text, level) || !add(tree)) return false;
+    for (const auto& p : level) {
+        if (!(p.first.back() == '/' ? reach(p.second, seen, out) : add(p.second))) return false;
+    }
+    return true;
+}
+
+string Repository::sendUpdates(Wire& w, const string& branch, SyncResult& result) {
+    string line;
+    // Tells the receiver, and reads its answer so it never writes to a closed pipe.
+    auto fail = [&](const string& why) {
+        w.send("error " + why + "\n");
+        w.flush();
+        w.readLine(line);
+        return why;
+    };
+    if (!w.readLine(line)) return "the connection closed";
+    if (line.rfind("error ", 0) == 0) return line.substr(6);
+    istringstream have(line);
+    string word, digest;
+    size_t known;
+    int theirTip;
+    if (!(have >> word >> known >> digest >> theirTip) || word != "have") return fail("protocol error");
+    int tip = refs.tip(branch);
+    result.tip = tip;
+    if (tip <= 0) return fail("there is no branch " + branch + " to send");
+    if (known > history.size() || history.digest(known) != digest)
+        return fail("the histories have diverged; one log must extend the other");
+    if (theirTip > 0 && !isAncestor(theirTip, tip)) return fail("branch " + branch + " has moved on there; not a fast-forward");
+
+    unordered_set<string> seen;
+    vector<string> candidates;
+    CommitLog::Record r, p;
+    for (size_t id = known + 1; id <= history.size(); ++id) {
+        if (!history.read(id, r)) return fail("commit " + to_string(id) + " is unreadable");
+        if (r.parent && r.parent <= known && (!history.read(r.parent, p) || !reach(p.tree, seen, nullptr)))
+            return fail("the tree of commit " + to_string(r.parent) + " is unreadable");
+    }
+    for (size_t id = known + 1; id <= history.size(); ++id) {
+        if (!history.read(id, r) || !reach(r.tree, seen, &candidates))
+            return fail("the tree of commit " + to_string(id) + " is unreadable");
+    }
+    string list = "objects " + to_string(candidates.size()) + "\n";
+    for (const string& h : candidates) list += h + "\n";
+    w.send(list);
+    w.flush();
+
+    size_t count;
+    vector<string> missing;
+    if (!w.readLine(line) || !parseCount(line, "missing", count)) return "protocol error";
+    while (missing.size() < count && w.readLine(line) && isObjectName(line)) missing.push_back(line);
+    if (missing.size() != count) return "protocol error";
+
+    // Objects are read a batch at a time on the pool while the receiver
+    // is still storing the previous batch.
+    w.send("pack " + to_string(count) + "\n");
+    const size_t BATCH = 32;
+    vector<string> raw;
+    for (size_t from = 0; from < count && w.writable(); from += BATCH) {
+        size_t n = min(BATCH, count - from);
+        raw.assign(n, string());
+        atomic<size_t> unreadable(0);
+        pool.parallelFor(n, [&](size_t i) { if (!objects.rawBytes(missing[from + i], raw[i])) ++unreadable; });
+        if (unreadable) return "an object to send is unreadable";
+        for (size_t i = 0; i < n; ++i) {
+            w.send(missing[from + i] + " " + to_string(raw[i].size()) + "\n");
+            w.send(raw[i]);
+            result.bytes += raw[i].size();
+        }
+    }
+    result.objects = count;
+
+    w.send("commits " + to_string(history.size() - known) + "\n");
+    string message;
+    for (size_t id = known + 1; id <= history.size(); ++id) {
+        if (!history.read(id, r, message)) return "commit " + to_string(id) + " is unreadable";
+        w.send("commit " + to_string(r.parent) + " " + to_string(r.timestamp) + " " + r.tree + " " + to_string(message.size()) + "\n");
+        w.send(message);
+    }
+    result.commits = history.size() - known;
+    w.send("tip " + to_string(tip) + "\n");
+    w.flush();
+    if (!w.readLine(line)) return "the connection closed";
+    if (line != "ok") return line.rfind("error ", 0) == 0 ? line.substr(6) : "protocol error";
+    return "";
+}
+
+string Repository::receiveUpdates(Wire& w, const string& branch, bool moveBranch, SyncResult& result) {
+    string why = receive(w, branch, moveBranch, result);
+    w.send(why.empty() ? "ok\n" : "error " + why + "\n");
+    w.flush();
+    return why;
+}
+
+string Repository::receive(Wire& w, const string& branch, bool moveBranch, SyncResult& result) {
+    string dir = ".vcs/objects/incoming-" + to_string(getpid());
+    error_code ec;
+    fs::remove_all(dir, ec);
+    string why;
+    {
+        ObjectStore incoming(dir, objects);
+        why = receiveInto(w, branch, moveBranch, result, incoming);
+    }
+    fs::remove_all(dir, ec);
+    return why;
+}
+
+string Repository::receiveInto(Wire& w, const string& branch, bool moveBranch, SyncResult& result, ObjectStore& incoming) {
+    WriteLock writing(*this);
+    if (!writing) return "the repository is locked by another writer";
+    size_t known = history.size();
+    w.send("have " + to_string(known) + " " + history.digest(known) + " " + to_string(refs.tip(branch)) + "\n");
+    w.flush();
+
+    string line;
+    size_t count;
+    if (!w.readLine(line)) return "the connection closed";
+    if (line.rfind("error ", 0) == 0) return line.substr(6);
+    vector<string> wanted;
+    if (!parseCount(line, "objects", count)) return "protocol error";
+    while (wanted.size() < count && w.readLine(line) && isObjectName(line)) wanted.push_back(move(line));
+    if (wanted.size() != count) return "protocol error";
+    vector<char> found = objects.hasEach(wanted);
+    vector<string> missing;
+    string list;
+    for (size_t i = 0; i < wanted.size(); ++i) {
+        if (found[i]) continue;
+        list += wanted[i] + "\n";
+        missing.push_back(wanted[i]);
+    }
+    w.send("missing " + to_string(missing.size()) + "\n" + list);
+    w.flush();
+
+    if (!w.readLine(line) || !parseCount(line, "pack", count) || count != missing.size()) return "protocol error";
+    unordered_set<string> expected(missing.begin(), missing.end());
+    const size_t BATCH = 32;
+    vector<pair<string, string>> batch;
+    for (size_t done = 0; done < count;) {
+        batch.clear();
+        for (; batch.size() < BATCH && done < count; ++done) {
+            size_t space, size;
+            if (!w.readLine(line) || (space = line.find(' ')) != 16 || !parseCount(line, line.substr(0, 16), size))
+                return "protocol error";
+            string hash = line.substr(0, 16);
+            if (!expected.erase(hash)) return "unexpected object " + hash;
+            batch.emplace_back(move(hash), string());
+            if (!w.readBytes(size, batch.back().second)) return "the connection closed";
+            result.bytes += size;
+        }
+        atomic<size_t> failed(0);
+        pool.parallelFor(batch.size(), [&](size_t i) { if (!incoming.putRaw(batch[i].first, batch[i].second)) ++failed; });
+        if (failed) return "could not store the objects sent";
+    }
+    result.objects = count;
+
+    vector<pair<CommitLog::Record, string>> commits;
+    if (!w.readLine(line) || !parseCount(line, "commits", count)) return "protocol error";
+    for (size_t i = 0; i < count; ++i) {
+        CommitLog::Record r;
+        string word;
+        size_t length;
+        if (!w.readLine(line)) return "the connection closed";
+        istringstream fields(line);
+        if (!(fields >> word >> r.parent >> r.timestamp >> r.tree >> length) || word != "commit" || !isObjectName(r.tree))
+            return "protocol error";
+        r.id = known + i + 1;
+        if (r.parent >= r.id) return "commit " + to_string(r.id) + " has a bad parent";
+        commits.emplace_back(r, string());
+        if (!w.readBytes(length, commits.back().second)) return "the connection closed";
+    }
+    if (!w.readLine(line) || line.rfind("tip ", 0) != 0) return "protocol error";
+    int tip = atoi(line.c_str() + 4);
+    if (tip <= 0 || size_t(tip) > known + count) return "protocol error";
+
+    // Everything must be here and intact before the log refers to it.
+    atomic<size_t> bad(0);
+    pool.parallelFor(missing.size(), [&](size_t i) { if (!incoming.verify(missing[i])) ++bad; });
+    if (bad) return to_string(bad.load()) + " objects arrived damaged";
+    vector<string> trees;
+    for (const auto& c : commits) trees.push_back(c.first.tree);
+    for (char present : incoming.hasEach(trees)) if (!present) return "a commit's tree was not sent";
+    int old = refs.tip(branch);
+    auto parentOf = [&](int id) {
+        CommitLog::Record r;
+        if (size_t(id) > known) return int(commits[id - known - 1].first.parent);
+        return history.read(id, r) ? int(r.parent) : 0;
+    };
+    int at = tip;
+    while (old > 0 && at > old) at = parentOf(at);
+    if (old > 0 && at != old) return "branch " + branch + " would lose commits; not a fast-forward";
+    if (!objects.publish(incoming)) return "could not store the objects sent";
+    if (!commits.empty() && !Sync::all(".")) return "could not sync the objects to disk";
+    for (auto& c : commits) {
+        if (!history.append(c.first, c.second)) return "could not update the commit log";
+    }
+    nextCommitId = int(history.size()) + 1;
+    if (moveBranch && old != tip && !refs.createBranch(branch, tip)) return "could not update branch " + branch;
+    if (!inTransaction && !Sync::all(".")) cout << "Warning: could not sync the received commits to disk." << endl;
+    result.commits = commits.size();
+    result.tip = tip;
+    return "";
+}
+
+Repository& Repository::getInstance() {
+    static Repository instance;
+    return instance;
+}
+
+void Repository::refresh() {
+    lock_guard<shared_mutex> api(apiMutex);
+    if (writeDepth == 0) catchUp(false);
+}
+
+void Repository::addFile(const shared_ptr<File>& f, bool announce) {
+    lock_guard<shared_mutex> api(apiMutex);
+    stagingChanged = true;
+    if (stagedFiles.insert(f) && announce) {
+        cout << "Added file to staging: " << f->getName() << endl;
+    }
+}
+
+void Repository::keepStaging() {
+    lock_guard<shared_mutex> api(apiMutex);
+    keepStagingLocked();
+}
+
+void Repository::keepStagingLocked() {
+    if (inTransaction || !stagingChanged) return;
+    WriteLock writing(*this);
+    if (writing && saveStaging()) stagingChanged = false;
+    else cout << "Warning: could not save the staging area; it lasts only for this session." << endl;
+}
+
+bool Repository::beginTransaction() {
+    lock_guard<shared_mutex> api(apiMutex);
+    if (!lockForWrite()) return false;
+    inTransaction = true;
+    transactionStartId = nextCommitId;
+    history.beginBatch();
+    refs.beginBatch();
+    return true;
+}
+
+bool Repository::endTransaction(bool success) {
+    lock_guard<shared_mutex> api(apiMutex);
+    inTransaction = false;
+    // As in receive(): the batch's objects and files reach the disk
+    // before the log and refs that name them, and those are synced next.
+    bool committed = nextCommitId != transactionStartId;
+    if (success && (!committed || Sync::all(".")) && history.commitBatch() && refs.commitBatch() && index.save()) {
+        if (stagingChanged && !saveStaging()) cout << "Warning: could not save the staging area." << endl;
+        stagingChanged = false;
+        if (!Sync::all(".")) cout << "Warning: could not sync the batch to disk." << endl;
+        unlockWrite();
+        return true;
+    }
+    history.abortBatch();
+    refs.abortBatch();
+    for (int id = transactionStartId; id < nextCommitId; ++id) commitsById.erase(id);
+    if (headCommit && headCommit->getId() >= transactionStartId) headCommit.reset();
+    nextCommitId = transactionStartId;
+    index.load(".vcs/index");
+    unlockWrite();
+    return false;
+}
+
+bool Repository::commit(const string& msg) {
+    lock_guard<shared_mutex> api(apiMutex);
+    VCSIM_TIMED(COMMIT);
+    vector<File*> editableFiles;
+    for (const auto& f : stagedFiles) {
+        if (f->isModified()) editableFiles.push_back(f.get());
+    }
+
+    if (editableFiles.empty()) {
+        cout << "No edited files to commit! Edit files first." << endl;
+        return false;
+    }
+
+    // Hash and store every object, then write the working files beside
+    // their targets, all in parallel. Nothing is recorded unless every
+    // write succeeded, so a failed commit leaves history, the staging area
+    // and the working files as they were. Edited files are stored as
+    // deltas against HEAD's version of them. The rest follows the journal
+    // protocol (see Journal); inside a transaction the journal is skipped
+    // and the transaction syncs once at its end. Objects are immutable, so
+    // only the steps from the working files on hold the writer lock; the
+    // parent is whatever HEAD is once it is taken.
+    size_t n = editableFiles.size();
+    vector<string> bases(n), blobs(n);
+    vector<char> text(n);
+    {
+        Tree tree = headTree();
+        for (size_t i = 0; i < n; ++i) {
+            text[i] = dynamic_cast<TextFile*>(editableFiles[i]) != nullptr;
+            const TreeEntry* e = tree.lookup(editableFiles[i]->getName());
+            if (e && text[i]) bases[i] = e->blob();
+        }
+    }
+    atomic<bool> failed(false);
+    {
+        VCSIM_TIMED(COMMIT_STORE);
+        pool.parallelFor(n, [&](size_t i) {
+            blobs[i] = storeStaged(*editableFiles[i], bases[i]);
+            if (blobs[i].empty()) failed = true;
+        });
+    }
+    WriteLock writing(*this);
+    if (!writing) {
+        cout << "Commit failed: the repository is locked. Nothing was committed." << endl;
+        return false;
+    }
+    if (!failed) {
+        // A full gc in another process may have pruned them, or the chunks
+        // of one, while they were unreachable; their delta bases are
+        // committed, so still there.
+        for (size_t i = 0; i < n; ++i) {
+            if (objects.complete(blobs[i])) continue;
+            blobs[i] = storeStaged(*editableFiles[i], "");
+            if (blobs[i].empty()) failed = true;
+        }
+    }
+    int parentId = refs.head();
+    Tree parentTree = headTree();
+    // A working file that already holds what is committed (as one added
+    // from disk does) is left alone. The others are rewritten, but only
+    // while they still hold what this repository last saw there (or
+    // HEAD's version): an edit made on disk since is never overwritten,
+    // and fails the commit instead. Content streamed from a working file
+    // now comes from the store.
+    vector<char> onDisk(n, 0), changed(n, 0);
+    if (!failed) {
+        vector<string> paths(n);
+        vector<uint64_t> seen(n, 0);
+        vector<char> wasSeen(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            File* f = editableFiles[i];
+            paths[i] = f->getName();
+            if (const StatCache::Entry* e = index.find(paths[i])) {
+                seen[i] = PackFile::parseHash(e->hash);
+                wasSeen[i] = 1;
+            }
+            if (!f->stagedInMemory()) f->restage(make_shared<StoredBlob>(objects, blobs[i]));
+        }
+        vector<uint64_t> hashes;
+        vector<char> present;
+        diskHashes(paths, hashes, present);
+        for (size_t i = 0; i < n; ++i) {
+            if (!present[i]) continue;
+            if (hashes[i] == PackFile::parseHash(blobs[i])) onDisk[i] = 1;
+            else if (!(wasSeen[i] && hashes[i] == seen[i]) && hashes[i] != editableFiles[i]->getContentHash()) changed[i] = 1;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (!changed[i]) continue;
+            cout << paths[i] << " changed on disk since it was added; add it again." << endl;
+            failed = true;
+        }
+        VCSIM_TIMED(COMMIT_WRITE_FILES);
+        if (!failed) {
+            pool.parallelFor(n, [&](size_t i) {
+                File* f = editableFiles[i];
+                if (!onDisk[i] && !f->writeStaged(File::pendingPath(f->getName()))) failed = true;
+            });
+        }
+    }
+    Journal journal;
+    for (size_t i = 0; i < n; ++i)
+        journal.files.push_back(Journal::Entry{editableFiles[i]->getName(), blobs[i], editableFiles[i]->getStagedHash()});
+    if (failed) {
+        removePending(journal.files);
+        for (size_t i = 0; i < n; ++i) {
+            if (blobs[i].empty() && !editableFiles[i]->stagedInMemory())
+                cout << editableFiles[i]->getName() << " changed on disk since it was added; add it again." << endl;
+        }
+        bool clobber = any_of(changed.begin(), changed.end(), [](char c) { return c != 0; });
+        cout << (clobber ? "Commit failed: files changed on disk. Nothing was committed."
+                         : "Commit failed: could not write every file. Nothing was committed.") << endl;
+        return false;
+    }
+
+    VCSIM_TIMED(COMMIT_RECORD);  // tree, log record, refs and index
+    // The new tree is HEAD's tree with the edited paths replaced: only
+    // the directories holding them are copied and stored, and every
+    // other directory (and the content it holds) is shared with the
+    // parent.
+    vector<TreeEntry> edited;
+    edited.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        File* f = editableFiles[i];
+        edited.push_back(TreeEntry{f->getName(), PackFile::parseHash(blobs[i]), text[i] ? TreeEntry::TEXT : TreeEntry::BINARY,
+                                   f->stagedInMemory() ? f->getSharedStagedContent() : nullptr});
+    }
+    sort(edited.begin(), edited.end(), [](const TreeEntry& x, const TreeEntry& y) { return x.path < y.path; });
+    Tree tree = parentTree.with(move(edited));
+
+    CommitLog::Record& record = journal.record;
+    record.id = nextCommitId;
+    record.parent = parentId;
+    record.timestamp = time(nullptr);
+    record.tree = putTree(*tree.node());
+    journal.branch = refs.branch();
+    journal.message = msg;
+    error_code ec;
+    if (record.tree.empty() || (!inTransaction && (!journal.write(JOURNAL) || !Sync::all(".")))) {
+        removePending(journal.files);
+        fs::remove(JOURNAL, ec);
+        cout << "Commit failed: could not write the commit journal. Nothing was committed." << endl;
+        return false;
+    }
+    // Past this point a crash is finished on the next start.
+    for (size_t i = 0; i < n; ++i) {
+        const string& path = journal.files[i].path;
+        if (onDisk[i]) continue;
+        fs::rename(File::pendingPath(path), path, ec);
+        if (ec) cout << "Warning: could not update " << path << " on disk." << endl;
+    }
+    if (!history.append(record, msg)) {
+        fs::remove(JOURNAL, ec);
+        cout << "Commit failed: could not update the commit log. Nothing was committed." << endl;
+        return false;
+    }
+    if (!refs.advance(nextCommitId)) cout << "Warning: could not update .vcs/HEAD." << endl;
+
+    for (size_t i = 0; i < n; ++i) {
+        editableFiles[i]->clearModified();
+        index.refresh(editableFiles[i]->getName(), blobs[i]);
+    }
+    saveIndex();
+    if (!inTransaction && Sync::all(".")) fs::remove(JOURNAL, ec);
+    headCommit = memory.make<Commit>(record, msg, move(tree));
+    commitsById[nextCommitId] = headCommit;
+    ++nextCommitId;
+
+    for (File* f : editableFiles) {
+        stagedFiles.erase(f->getName());
+    }
+    stagingChanged = true;
+    keepStagingLocked();
+
+    cout << "Commit done! Changes saved to .vcs and original files updated." << endl;
+    return true;
+}
+
+void Repository::log(const LogOptions& opts) const {
+    shared_lock<shared_mutex> api(apiMutex);
+    VCSIM_TIMED(LOG);
+    if (refs.head() == 0) { 
+        cout << "No commits yet." << endl; 
+        return; 
+    }
+    ostringstream buf;
+    size_t shown = 0;
+    shared_ptr<const Commit> next;  // the last commit's parent, usually the next one shown
+    for (int id = refs.head(), parent; id >= 1 && shown < opts.limit; id = parent) {
+        CommitLog::Record r;
+        string message;
+        if (!history.read(id, r, message)) { buf << "Commit " << id << ": unreadable\n"; break; }
+        // Parents always have smaller ids, so a damaged record cannot loop.
+        parent = int(r.parent) < id ? int(r.parent) : 0;
+        // A parent is never newer than its child, so nothing older can match.
+        if (time_t(r.timestamp) < opts.since) break;
+        if (!opts.grep.empty() && message.find(opts.grep) == string::npos) continue;
+        ++shown;
+        if (opts.oneline) {
+            buf << id << ' ' << message << '\n';
+        } else {
+            shared_ptr<const Commit> c = next && next->getId() == id ? next : peekCommit(id);
+            if (!c) { buf << "Commit " << id << ": unreadable\n"; continue; }
+            next = c->getParent() ? peekCommit(c->getParent()) : nullptr;
+            c->showDetails(buf, next.get(), objects);
+            buf << "--------------------\n";
+        }
+        if (buf.tellp() > (1 << 16)) { cout << buf.str(); buf.str(""); }
+    }
+    if (shown == 0) buf << "No matching commits.\n";
+    cout << buf.str() << flush;
+}
+
+shared_ptr<const Commit> Repository::findCommit(int commitId) const {
+    shared_lock<shared_mutex> api(apiMutex);
+    return commitAt(commitId);
+}
+
+bool Repository::checkout(int commitId, FileSet& workingFiles, bool force, const string& branch) {
+    lock_guard<shared_mutex> api(apiMutex);
+    return checkoutLocked(commitId, workingFiles, force, branch);
+}
+
+bool Repository::checkoutLocked(int commitId, FileSet& workingFiles, bool force, const string& branch) {
+    VCSIM_TIMED(CHECKOUT);
+    shared_ptr<const Commit> c = commitAt(commitId);
+    if (!c) {
+        cout << "Commit ID not found!" << endl;
+        return false;
+    }
+    const Tree& target = c->getSnapshot();
+    Tree current = headTree();
+    vector<const TreeEntry*> snapshot;
+    snapshot.reserve(target.size());
+    target.forEach([&](const TreeEntry& e) { snapshot.push_back(&e); });
+    FileSet next;
+    vector<shared_ptr<File>> toWrite;
+    vector<string> toRemove;
+    atomic<size_t> failures(0);
+    next.reserve(snapshot.size());
+    // Unedited paths may already hold what they should: the target's
+    // version, or for paths the target lacks HEAD's (so they may go).
+    vector<pair<string, uint64_t>> probe;
+    vector<size_t> probeOf(snapshot.size(), SIZE_MAX);
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        shared_ptr<File> f = workingFiles.find(snapshot[i]->path);
+        if (force || (f && f->isModified())) continue;
+        probeOf[i] = probe.size();
+        probe.emplace_back(snapshot[i]->path, snapshot[i]->hash);
+    }
+    size_t kept = probe.size();
+    // Directories the two trees share are skipped whole in finding the
+    // paths the target lacks.
+    Tree::compare(current, target, [&](const TreeEntry* e, const TreeEntry* t) {
+        if (!e || t) return;
+        shared_ptr<File> f = workingFiles.find(e->path);
+        if (!(f && f->isModified())) probe.emplace_back(e->path, e->hash);
+    });
+    vector<char> holds = diskHolds(probe);
+    for (size_t k = kept; k < probe.size(); ++k) {
+        if (holds[k]) toRemove.push_back(probe[k].first);
+    }
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        const TreeEntry& e = *snapshot[i];
+        shared_ptr<File> f = workingFiles.find(e.path);
+        bool upToDate = probeOf[i] != SIZE_MAX && holds[probeOf[i]];
+        if (!upToDate || !f) {
+            if (!(f = fileFor(e))) {
+                cout << "Warning: content of " << e.path << " is unavailable." << endl;
+                ++failures;
+                continue;
+            }
+            if (!upToDate) toWrite.push_back(f);
+        }
+        next.insert(f);
+    }
+
+    vector<char> written(toWrite.size(), 0);
+    pool.parallelFor(toWrite.size(), [&](size_t i) {
+        if (toWrite[i]->saveToDisk()) written[i] = 1;
+        else ++failures;
+    });
+    for (size_t i = 0; i < toWrite.size(); ++i) {
+        if (written[i]) index.refresh(toWrite[i]->getName(), ContentHash::hex(toWrite[i]->getContentHash()));
+    }
+    for (const string& path : toRemove) {
+        error_code ec;
+        if (fs::remove(path, ec)) index.erase(path);
+        else if (ec) ++failures;
+        // Directories left empty go too, as they were not there before.
+        for (fs::path dir = fs::path(path).parent_path(); !dir.empty() && fs::is_empty(dir, ec) && fs::remove(dir, ec);
+             dir = dir.parent_path()) {}
+    }
+    WriteLock writing(*this);
+    if (writing) saveIndex();
+    workingFiles = move(next);
+    bool moved = writing && (branch.empty() ? refs.detach(commitId) : refs.switchTo(branch, commitId));
+    if (!moved) cout << "Warning: could not update .vcs/HEAD." << endl;
+
+    if (branch.empty()) cout << "Checked out commit " << commitId << ", files restored on disk." << endl;
+    else cout << "Switched to branch " << branch << " (commit " << commitId << ")." << endl;
+    cout << toWrite.size() << " of " << snapshot.size() << " files written";
+    if (!toRemove.empty()) cout << ", " << toRemove.size() << " removed";
+    if (failures) cout << ", " << failures << " failed";
+    cout << "." << endl;
+    return failures == 0 && moved;
+}
+
+int Repository::branchTip(const string& name) const {
+    shared_lock<shared_mutex> api(apiMutex);
+    return refs.tip(name);
+}
+
+int Repository::commitByHash(const string& prefix) const {
+    shared_lock<shared_mutex> api(apiMutex);
+    return int(history.findHash(prefix));
+}
+
+bool Repository::createBranch(const string& name, int at) {
+    lock_guard<shared_mutex> api(apiMutex);
+    WriteLock writing(*this);
+    if (!writing) return false;
+    if (!Refs::validName(name)) {
+        cout << "Invalid branch name: " << name << endl;
+        return false;
+    }
+    if (refs.tip(name) >= 0) {
+        cout << "Branch " << name << " already exists." << endl;
+        return false;
+    }
+    if (at == 0 || !commitAt(at)) {
+        cout << (at == 0 ? "No commits yet; commit before creating a branch." : "Commit ID not found!") << endl;
+        return false;
+    }
+    if (!refs.createBranch(name, at)) {
+        cout << "Could not write branch " << name << "." << endl;
+        return false;
+    }
+    cout << "Created branch " << name << " at commit " << at << "." << endl;
+    return true;
+}
+
+int Repository::head() const {
+    shared_lock<shared_mutex> api(apiMutex);
+    return refs.head();
+}
+
+bool Repository::push(const string& url, const string& branch) {
+    lock_guard<shared_mutex> api(apiMutex);
+    if (inTransaction && nextCommitId != transactionStartId) {
+        cout << "Push failed: commits made earlier in this batch are not final yet; push in a separate run." << endl;
+        return false;
+    }
+    Remote remote;
+    if (!remote.open(url)) {
+        cout << "Push failed: could not start vcsim for " << url << "." << endl;
+        return false;
+    }
+    remote.wire().send("push " + branch + "\n");
+    remote.wire().flush();
+    SyncResult result;
+    string why = sendUpdates(remote.wire(), branch, result);
+    remote.close();
+    if (!why.empty()) {
+        cout << "Push failed: " << why << "." << endl;
+        return false;
+    }
+    cout << "Pushed " << result.commits << " commits and " << result.objects << " objects (" << result.bytes
+         << " bytes) to " << url << "; " << branch << " is at commit " << result.tip << " there." << endl;
+    return true;
+}
+
+bool Repository::pull(const string& url, const string& branch, FileSet& workingFiles) {
+    lock_guard<shared_mutex> api(apiMutex);
+    Remote remote;
+    if (!remote.open(url)) {
+        cout << "Pull failed: could not start vcsim for " << url << "." << endl;
+        return false;
+    }
+    remote.wire().send("pull " + branch + "\n");
+    remote.wire().flush();
+    bool current = branch == refs.branch();
+    SyncResult result;
+    string why = receiveUpdates(remote.wire(), branch, !current, result);
+    remote.close();
+    if (!why.empty()) {
+        cout << "Pull failed: " << why << "." << endl;
+        return false;
+    }
+    cout << "Pulled " << result.commits << " commits and " << result.objects << " objects (" << result.bytes
+         << " bytes) from " << url << "; " << branch << " is at commit " << result.tip << "." << endl;
+    if (!current || result.tip == refs.head()) return true;
+    return checkoutLocked(result.tip, workingFiles, false, branch);
+}
+
+bool Repository::serve(Wire& w) {
+    lock_guard<shared_mutex> api(apiMutex);
+    string line;
+    if (!w.readLine(line)) return false;
+    string branch = line.size() > 5 ? line.substr(5) : "";
+    SyncResult result;
+    if (line.rfind("push ", 0) == 0 && Refs::validName(branch)) return receiveUpdates(w, branch, true, result).empty();
+    if (line.rfind("pull ", 0) == 0 && Refs::validName(branch)) return sendUpdates(w, branch, result).empty();
+    w.send("error unknown request\n");
+    w.flush();
+    return false;
+}
+
+void Repository::listBranches() const {
+    shared_lock<shared_mutex> api(apiMutex);
+    string out;
+    if (refs.branch().empty()) out += "* (detached at commit " + to_string(refs.head()) + ")\n";
+    else if (refs.tip(refs.branch()) < 0) out += "* " + refs.branch() + " (no commits yet)\n";
+    for (const auto& t : refs.branches())
+        out += (t.first == refs.branch() ? "* " : "  ") + t.first + " -> " + to_string(t.second) + "\n";
+    cout << out << flush;
+}
+
+bool Repository::diff(int fromId, int toId) const {
+    shared_lock<shared_mutex> api(apiMutex);
+    shared_ptr<const Commit> from = commitAt(fromId);
+    shared_ptr<const Commit> to = commitAt(toId);
+    if (!from || !to) {
+        cout << "Commit ID not found!" << endl;
+        return false;
+    }
+
+    ostringstream buf;
+    size_t changed = 0;
+    // Walks both trees together, skipping the directories they share; a
+    // path only one side has comes up alone.
+    Tree::compare(from->getSnapshot(), to->getSnapshot(), [&](const TreeEntry* ea, const TreeEntry* eb) {
+        const string& path = ea ? ea->path : eb->path;
+        // Binary content (or content too large to read at all) is not read.
+        string before, after;
+        TreeEntry::Kind kind;
+        bool binary = (ea && ea->resolveKind(objects, kind, &before) && kind == TreeEntry::BINARY) ||
+                      (eb && eb->resolveKind(objects, kind, &after) && kind == TreeEntry::BINARY);
+        if (!binary && ((ea && before.empty() && !ea->contentIn(objects, before))
+                        || (eb && after.empty() && !eb->contentIn(objects, after)))) {
+            cout << "Warning: content of " << path << " is unavailable; skipped." << endl;
+            return;
+        }
+        string fromName = ea ? "a/" + path : "/dev/null", toName = eb ? "b/" + path : "/dev/null";
+        ++changed;
+        buf << "diff " << path << '\n';
+        if (binary || File::looksBinary(before) || File::looksBinary(after)) {
+            buf << "Binary files " << fromName << " and " << toName << " differ\n";
+            return;
+        }
+        LineDiff d(before, after);
+        buf << "--- " << fromName << '\n'
+            << "+++ " << toName << '\n';
+        d.writeUnified(buf);
+        if (buf.tellp() > (1 << 16)) { cout << buf.str(); buf.str(""); }
+    });
+    if (changed == 0) buf << "No differences.\n";
+    cout << buf.str() << flush;
+    return true;
+}
+
+void Repository::gc(bool autoOnly) {
+    lock_guard<shared_mutex> api(apiMutex);
+    finishBackgroundGc();
+    WriteLock writing(*this);
+    if (!writing) return;
+    if (autoOnly && !gcWanted()) {
+        cout << "Nothing to do." << endl;
+        return;
+    }
+    ObjectStore::RepackResult r;
+    if (!runGc(gcRoots(), !autoOnly, r)) {
+        cout << "gc failed: could not read every tree or write the pack. No objects were removed." << endl;
+        return;
+    }
+    if (r.packed == 0 && r.pruned == 0) {
+        cout << "Nothing to pack." << endl;
+        return;
+    }
+    cout << "Packed " << r.packed << " objects";
+    if (r.deltified) cout << " (" << r.deltified << " now stored as deltas)";
+    cout << ", removed " << r.pruned << " unreachable." << endl;
+}
+
+void Repository::backgroundGc() {
+    lock_guard<shared_mutex> api(apiMutex);
+    if (gcRunning || !gcWanted()) return;
+    finishBackgroundGc();
+    gcRunning = true;
+    gcThread = thread([this, roots = gcRoots()] {
+        lowerThreadPriority();
+        ObjectStore::RepackResult r;
+        runGc(roots, false, r);
+        gcRunning = false;
+    });
+}
+
+vector<string> Repository::walk(const string& dir, const IgnoreRules& ignore) {
+    vector<string> files, level{dir};
+    while (!level.empty()) {
+        vector<vector<string>> found(level.size()), subdirs(level.size());
+        pool.parallelFor(level.size(), [&](size_t i) {
+            error_code ec;
+            for (fs::directory_iterator it(level[i].empty() ? fs::path(".") : fs::path(level[i]), ec), end;
+                 !ec && it != end; it.increment(ec)) {
+                error_code typeEc;
+                string name = it->path().filename().string();
+                string path = level[i].empty() ? name : level[i] + "/" + name;
+                bool isDir = !it->is_symlink(typeEc) && it->is_directory(typeEc);
+                if (ignore.ignored(path, name, isDir)) continue;
+                if (isDir) subdirs[i].push_back(move(path));
+                else if (it->is_regular_file(typeEc)) found[i].push_back(move(path));
+            }
+        });
+        level.clear();
+        for (size_t i = 0; i < found.size(); ++i) {
+            files.insert(files.end(), make_move_iterator(found[i].begin()), make_move_iterator(found[i].end()));
+            level.insert(level.end(), make_move_iterator(subdirs[i].begin()), make_move_iterator(subdirs[i].end()));
+        }
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+void Repository::readChanged(const vector<string>& paths, vector<shared_ptr<File>>& loaded) {
+    lock_guard<shared_mutex> api(apiMutex);
+    loaded.assign(paths.size(), nullptr);
+    vector<StatCache::Entry> stats(paths.size());
+    vector<string> hashes(paths.size());
+    pool.parallelFor(paths.size(), [&](size_t i) {
+        if (!StatCache::statFile(paths[i], stats[i]) || index.isUnchanged(paths[i], stats[i])) return;
+        shared_ptr<File> f = File::loadFromDisk(paths[i], &memory);
+        if (!f) return;
+        hashes[i] = ContentHash::hex(f->getContentHash());
+        const StatCache::Entry* old = index.find(paths[i]);
+        if (!old || old->hash != hashes[i]) loaded[i] = move(f);
+    });
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!hashes[i].empty()) index.record(paths[i], stats[i], hashes[i]);
+    }
+    saveIndex();
+}
+
+bool Repository::readIfChanged(const string& path, shared_ptr<File>& loaded) {
+    vector<shared_ptr<File>> found;
+    readChanged({path}, found);
+    loaded = move(found[0]);
+    return loaded != nullptr;
+}
+
+shared_ptr<File> Repository::committedFile(const string& path, const string& blob) const {
+    shared_lock<shared_mutex> api(apiMutex);
+    Tree head = headTree();
+    const TreeEntry* e = head.lookup(path);
+    if (!e || (!blob.empty() && e->blob() != blob)) return nullptr;
+    return fileFor(*e);
+}
+
+void Repository::recordOnDisk(const shared_ptr<File>& f) {
+    lock_guard<shared_mutex> api(apiMutex);
+    index.refresh(f->getName(), ContentHash::hex(f->getContentHash()));
+    saveIndex();
+}
+
+void Repository::status(const FileSet& workingFiles) {
+    shared_lock<shared_mutex> api(apiMutex);
+    lock_guard<mutex> indexUpdates(indexMutex);
+    Tree head = headTree();
+    set<string> paths;
+    for (const string& p : index.paths()) paths.insert(p);
+    for (const auto& f : workingFiles) paths.insert(f->getName());
+    head.forEach([&](const TreeEntry& e) { paths.insert(e.path); });
+    vector<string> list(paths.begin(), paths.end());
+
+    enum State : char { CLEAN, MODIFIED, DELETED, UNTRACKED };
+    vector<State> states(list.size(), CLEAN);
+    vector<char> tracked(list.size(), 0), reread(list.size(), 0);
+    vector<uint64_t> expected(list.size(), 0), hashes(list.size(), 0);
+    for (size_t i = 0; i < list.size(); ++i) {
+        if (shared_ptr<File> f = stagedFiles.find(list[i])) expected[i] = f->getStagedHash();
+        else if (const TreeEntry* e = head.lookup(list[i])) expected[i] = e->hash;
+        else continue;
+        tracked[i] = 1;
+    }
+    vector<StatCache::Entry> stats(list.size());
+    pool.parallelFor(list.size(), [&](size_t i) {
+        if (!StatCache::statFile(list[i], stats[i])) { if (tracked[i]) states[i] = DELETED; return; }
+        if (index.isUnchanged(list[i], stats[i])) hashes[i] = PackFile::parseHash(index.find(list[i])->hash);
+        else if (File::hashOnDisk(list[i], hashes[i])) reread[i] = 1;
+        else { if (tracked[i]) states[i] = DELETED; return; }
+        if (!tracked[i]) states[i] = UNTRACKED;
+        else if (hashes[i] != expected[i]) states[i] = MODIFIED;
+    });
+
+    string out;
+    vector<string> staged;
+    for (const auto& f : stagedFiles) if (f->isModified()) staged.push_back(f->getName());
+    if (!staged.empty()) {
+        out += "Changes to be committed:\n";
+        for (const string& name : staged) out += "  modified: " + name + "\n";
+    }
+    string unstaged;
+    for (size_t i = 0; i < list.size(); ++i) {
+        if (states[i] == MODIFIED) unstaged += "  modified: " + list[i] + "\n";
+        else if (states[i] == DELETED) unstaged += "  deleted:  " + list[i] + "\n";
+        else if (states[i] == UNTRACKED) unstaged += "  new:      " + list[i] + "\n";
+        // Reread under new stat data: refresh so the next check is free.
+        if (reread[i]) index.record(list[i], stats[i], ContentHash::hex(hashes[i]));
+    }
+    saveIndex();
+    if (!unstaged.empty()) out += "Changes on disk not yet added:\n" + unstaged;
+    if (out.empty()) out = "Nothing to commit, working tree clean.\n";
+    cout << out << flush;
+}
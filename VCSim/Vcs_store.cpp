@@ -0,0 +1,713 @@
+#include "Vcs_oops.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#ifdef VCSIM_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+vector<string_view> LineDelta::splitLines(const string& s) {
+    vector<string_view> lines;
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t nl = s.find('\n', start);
+        size_t end = nl == string::npos ? s.size() : nl + 1;
+        lines.emplace_back(s.data() + start, end - start);
+        start = end;
+    }
+    return lines;
+}
+
+void LineDelta::putVarint(string& out, uint64_t v) {
+    while (v >= 0x80) { out += char(v | 0x80); v >>= 7; }
+    out += char(v);
+}
+
+bool LineDelta::getVarint(const string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        uint8_t b = in[pos++];
+        v |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+string LineDelta::make(const string& base, const string& target) {
+    vector<string_view> b = splitLines(base), t = splitLines(target);
+    unordered_map<string_view, vector<size_t>, FastHash::Hasher> where;
+    for (size_t j = 0; j < b.size(); ++j) where[b[j]].push_back(j);
+
+    string out, pending;
+    size_t copyStart = 0, copyLen = 0;
+    auto flushCopy = [&]() {
+        if (!copyLen) return;
+        out += char(COPY); putVarint(out, copyStart); putVarint(out, copyLen);
+        copyLen = 0;
+    };
+    auto flushInsert = [&]() {
+        if (pending.empty()) return;
+        out += char(INSERT); putVarint(out, pending.size()); out += pending;
+        pending.clear();
+    };
+
+    for (const string_view& line : t) {
+        size_t next = copyStart + copyLen;
+        if (copyLen && next < b.size() && b[next] == line) { ++copyLen; continue; }
+        auto it = where.find(line);
+        if (it == where.end()) { flushCopy(); pending.append(line); continue; }
+        flushCopy(); flushInsert();
+        // Prefer the first occurrence at or after where the last copy ended.
+        const vector<size_t>& js = it->second;
+        auto j = lower_bound(js.begin(), js.end(), next);
+        copyStart = j != js.end() ? *j : js.front();
+        copyLen = 1;
+    }
+    flushCopy(); flushInsert();
+    return out;
+}
+
+bool LineDelta::apply(const string& base, const string& delta, string& out) {
+    vector<string_view> b = splitLines(base);
+    out.clear();
+    size_t pos = 0;
+    while (pos < delta.size()) {
+        char op = delta[pos++];
+        uint64_t x, y;
+        if (op == COPY) {
+            if (!getVarint(delta, pos, x) || !getVarint(delta, pos, y) || x + y > b.size()) return false;
+            for (uint64_t j = x; j < x + y; ++j) out.append(b[j]);
+        } else if (op == INSERT) {
+            if (!getVarint(delta, pos, x) || pos + x > delta.size()) return false;
+            out.append(delta, pos, x);
+            pos += x;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Chunker::cut(const char* data, size_t n) {
+    if (n <= MIN) return n;
+    static constexpr Gear gear;
+    const uint64_t* G = gear.t;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    size_t end = min(n, MAX), at = MIN;
+    VCSIM_TIMED(CHUNK);
+    VCSIM_BYTES(CHUNK, end - MIN);
+    for (; at + ROUND <= end; at += ROUND) {
+        uint64_t mask = at < AVG ? MASK_S : MASK_L, h[LANES] = {};
+        size_t hit[LANES] = {};
+        for (size_t l = 0; l < LANES; ++l) {
+            for (size_t i = at + l * BLOCK - WINDOW; i < at + l * BLOCK; ++i) h[l] = (h[l] << 1) + G[p[i]];
+        }
+        for (size_t k = 0; k < BLOCK; ++k) {
+            for (size_t l = 0; l < LANES; ++l) {
+                h[l] = (h[l] << 1) + G[p[at + l * BLOCK + k]];
+                if (!(h[l] & mask) && !hit[l]) hit[l] = k + 1;
+            }
+        }
+        for (size_t l = 0; l < LANES; ++l) {
+            if (hit[l]) return at + l * BLOCK + hit[l];
+        }
+    }
+    uint64_t h = 0;
+    for (size_t i = at - WINDOW; i < end; ++i) {
+        h = (h << 1) + G[p[i]];
+        if (i >= at && !(h & (i < AVG ? MASK_S : MASK_L))) return i + 1;
+    }
+    return end;
+}
+
+bool NoCodec::decompress(string_view in, size_t rawSize, string& out) const {
+    if (in.size() != rawSize) return false;
+    out.assign(in);
+    return true;
+}
+
+void Lz4Codec::putLength(string& out, size_t len) {
+    for (; len >= 255; len -= 255) out += char(255);
+    out += char(len);
+}
+
+void Lz4Codec::emit(string& out, const char* lit, size_t litLen, size_t offset, size_t matchLen) {
+    size_t m = matchLen ? matchLen - MIN_MATCH : 0;
+    out += char((min<size_t>(litLen, 15) << 4) | (matchLen ? min<size_t>(m, 15) : 0));
+    if (litLen >= 15) putLength(out, litLen - 15);
+    out.append(lit, litLen);
+    if (!matchLen) return;
+    out += char(offset & 0xff);
+    out += char(offset >> 8);
+    if (m >= 15) putLength(out, m - 15);
+}
+
+bool Lz4Codec::compress(string_view in, string& out) const {
+    const char* src = in.data();
+    size_t n = in.size(), anchor = 0, i = 0;
+    out.clear();
+    out.reserve(n + n / 255 + 16);
+    if (n > MF_LIMIT) {
+        vector<uint32_t> table(1 << 16, UINT32_MAX);
+        size_t limit = n - MF_LIMIT, matchEnd = n - LAST_LITERALS;
+        while (i < limit) {
+            uint32_t seq;
+            memcpy(&seq, src + i, 4);
+            uint32_t h = (seq * 2654435761u) >> 16;
+            uint32_t cand = table[h];
+            table[h] = uint32_t(i);
+            uint32_t other;
+            if (cand == UINT32_MAX || i - cand > 65535 || (memcpy(&other, src + cand, 4), other != seq)) {
+                ++i;
+                continue;
+            }
+            size_t len = MIN_MATCH;
+            while (i + len < matchEnd && src[cand + len] == src[i + len]) ++len;
+            emit(out, src + anchor, i - anchor, i - cand, len);
+            i += len;
+            anchor = i;
+        }
+    }
+    emit(out, src + anchor, n - anchor, 0, 0);
+    return true;
+}
+
+bool Lz4Codec::decompress(string_view in, size_t rawSize, string& out) const {
+    out.assign(rawSize, '\0');
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(in.data());
+    const uint8_t* end = ip + in.size();
+    size_t op = 0;
+    auto readLength = [&](size_t len) -> size_t {
+        if (len != 15) return len;
+        for (uint8_t b = 255; b == 255 && ip < end; len += b) b = *ip++;
+        return len;
+    };
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t litLen = readLength(token >> 4);
+        if (litLen > size_t(end - ip) || litLen > rawSize - op) return false;
+        memcpy(&out[op], ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == end) break;
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (size_t(ip[1]) << 8);
+        ip += 2;
+        size_t len = readLength(token & 15) + MIN_MATCH;
+        if (offset == 0 || offset > op || len > rawSize - op) return false;
+        // Byte by byte: matches may overlap their own output.
+        for (size_t k = 0; k < len; ++k, ++op) out[op] = out[op - offset];
+    }
+    return op == rawSize;
+}
+
+#ifdef VCSIM_WITH_ZSTD
+class ZstdCodec : public Codec {
+    int level;
+public:
+    explicit ZstdCodec(int l = 9) : level(l) {}
+    uint8_t id() const override { return 2; }
+    const char* name() const override { return "zstd"; }
+
+    bool compress(string_view in, string& out) const override {
+        out.resize(ZSTD_compressBound(in.size()));
+        size_t n = ZSTD_compress(&out[0], out.size(), in.data(), in.size(), level);
+        if (ZSTD_isError(n)) return false;
+        out.resize(n);
+        return true;
+    }
+
+    bool decompress(string_view in, size_t rawSize, string& out) const override {
+        out.resize(rawSize);
+        size_t n = ZSTD_decompress(&out[0], rawSize, in.data(), in.size());
+        return !ZSTD_isError(n) && n == rawSize;
+    }
+    // Frames written by compress() record their size; others are refused.
+    uint64_t maxRawSize(string_view in) const override {
+        unsigned long long n = ZSTD_getFrameContentSize(in.data(), in.size());
+        return n == ZSTD_CONTENTSIZE_UNKNOWN || n == ZSTD_CONTENTSIZE_ERROR ? 0 : n;
+    }
+};
+#endif
+
+const Codec* Codec::byId(uint8_t id) {
+    static const NoCodec none;
+    static const Lz4Codec lz4;
+#ifdef VCSIM_WITH_ZSTD
+    static const ZstdCodec zstd;
+    if (id == zstd.id()) return &zstd;
+#endif
+    if (id == none.id()) return &none;
+    if (id == lz4.id()) return &lz4;
+    return nullptr;
+}
+
+const Codec* Codec::byName(const string& name) {
+    for (uint8_t id = 0; id < 3; ++id) {
+        const Codec* c = byId(id);
+        if (c && name == c->name()) return c;
+    }
+    return nullptr;
+}
+
+uint32_t PackFile::fanout(int b) const {
+    uint32_t v;
+    memcpy(&v, idx.data() + 8 + size_t(b) * 4, 4);
+    return v;
+}
+
+bool PackFile::open(const string& base) {
+    basePath = base;
+    if (!idx.open(base + ".idx") || !data.open(base + ".pack")) return false;
+    if (idx.size() < 8 + FANOUT_SIZE || memcmp(idx.data(), MAGIC, 8) != 0) return false;
+    count = fanout(255);
+    return idx.size() >= 8 + FANOUT_SIZE + count * ENTRY_SIZE;
+}
+
+bool PackFile::find(uint64_t hash, string_view& out) const {
+    int b = int(hash >> 56);
+    size_t lo = b == 0 ? 0 : fanout(b - 1), hi = fanout(b);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        uint64_t h;
+        memcpy(&h, entry(mid), 8);
+        if (h < hash) lo = mid + 1;
+        else if (h > hash) hi = mid;
+        else {
+            uint64_t offset, length;
+            memcpy(&offset, entry(mid) + 8, 8);
+            memcpy(&length, entry(mid) + 16, 8);
+            if (offset + length > data.size()) return false;
+            out = string_view(data.data() + offset, length);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ObjectStore::isHash(string_view h) {
+    return h.size() == 16 && all_of(h.begin(), h.end(), [](char c) { return isdigit(c) || (c >= 'a' && c <= 'f'); });
+}
+
+bool ObjectStore::ViewSource::read(char* p, size_t n) {
+    if (n > rest.size()) return false;
+    memcpy(p, rest.data(), n);
+    rest.remove_prefix(n);
+    return true;
+}
+
+bool ObjectStore::readRaw(const string& hash, char& kind, string& base, string& payload) const {
+    return withObject(hash, [&](auto& src, size_t size) {
+        Header h;
+        if (!readHeader(src, h) || !readPayload(src, h, size, payload)) return false;
+        kind = h.kind;
+        base = h.base;
+        return true;
+    });
+}
+
+int ObjectStore::depthOf(const string& hash) const {
+    int depth = -1;
+    withObject(hash, [&](auto& src, size_t) {
+        Header h;
+        if (!readHeader(src, h) || h.kind == 'C') return false;
+        depth = h.depth;
+        return true;
+    });
+    return depth;
+}
+
+void ObjectStore::loadPacks() const {
+    auto list = make_shared<PackList>();
+    error_code ec;
+    for (fs::directory_iterator it(root + "/pack", ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->path().extension() != ".idx") continue;
+        auto pack = make_shared<PackFile>();
+        fs::path base = it->path();
+        if (pack->open(base.replace_extension("").string())) list->push_back(move(pack));
+    }
+    atomic_store(&packs, shared_ptr<const PackList>(move(list)));
+}
+
+bool ObjectStore::compress(string_view payload, string& prefix, string& packed) const {
+    if (codec->id() == 0) return false;
+    VCSIM_TIMED(COMPRESS);
+    VCSIM_BYTES(COMPRESS, payload.size());
+    if (!codec->compress(payload, packed) || packed.size() + COMPRESSED_HEADER >= payload.size()) {
+        packed.clear();
+        return false;
+    }
+    uint64_t rawSize = payload.size();
+    prefix = string("Z") + char(codec->id()) + string(reinterpret_cast<const char*>(&rawSize), 8);
+    return true;
+}
+
+bool ObjectStore::writeRaw(const string& hash, const string& kind, string_view payload) {
+    string packed, prefix;
+    string_view body = compress(payload, prefix, packed) ? string_view(packed) : payload;
+    return writeObject(hash, {prefix, kind, body});
+}
+
+bool ObjectStore::writeObject(const string& hash, initializer_list<string_view> parts) {
+    static atomic<unsigned> tmpCounter(0);
+    VCSIM_TIMED(OBJECT_WRITE);
+    error_code ec;
+    fs::create_directories(root + "/" + hash.substr(0, 2), ec);
+    string path = objectPath(hash);
+    string tmp = path + ".tmp" + to_string(tmpCounter++);
+    ofstream out(tmp, ios::binary);
+    for (string_view part : parts) {
+        VCSIM_BYTES(OBJECT_WRITE, part.size());
+        out.write(part.data(), part.size());
+    }
+    out.close();
+    if (!out) { fs::remove(tmp, ec); return false; }
+    fs::rename(tmp, path, ec);
+    if (ec) { fs::remove(tmp, ec); return false; }
+    return true;
+}
+
+ObjectStore::ObjectStore(const string& r, int depth)
+    : root(r), maxDeltaDepth(depth), codec(Codec::byName("lz4")) {
+    fs::create_directories(root);
+    loadPacks();
+}
+
+ObjectStore::ObjectStore(const string& r, const ObjectStore& main)
+    : root(r), maxDeltaDepth(main.maxDeltaDepth), codec(main.codec), fallback(&main) {
+    fs::create_directories(root);
+    loadPacks();
+}
+
+string ObjectStore::hashContent(string_view data) {
+    VCSIM_TIMED(HASH);
+    VCSIM_BYTES(HASH, data.size());
+    return ContentHash::hex(ContentHash::of(data));
+}
+
+string ObjectStore::objectPath(const string& hash) const {
+    return root + "/" + hash.substr(0, 2) + "/" + hash.substr(2);
+}
+
+bool ObjectStore::inPacks(uint64_t key) const {
+    string_view unused;
+    for (const auto& pack : *packList()) if (pack->find(key, unused)) return true;
+    return false;
+}
+
+unordered_map<uint64_t, string> ObjectStore::redeltify(const RepackPlan& plan) const {
+    unordered_map<uint64_t, string> out;
+    unordered_map<string, string> rebased;  // blob -> its new base
+    for (const auto& d : plan.deltas) {
+        if (plan.cancel && plan.cancel->load()) break;
+        const string& hash = d.first;
+        char kind;
+        string next;
+        if (rebased.count(hash) || !fs::exists(objectPath(hash)) || !peek(hash, kind, next) || kind != 'B') continue;
+        int depth = 0;
+        bool usable = true;
+        for (string b = d.second; usable; b = next, ++depth) {
+            auto it = rebased.find(b);
+            if (b == hash || depth > 255) usable = false;
+            else if (it != rebased.end()) next = it->second;
+            else usable = peek(b, kind, next) && kind != 'C';
+            if (next.empty()) break;
+        }
+        string data, base, delta;
+        if (!usable || depth >= maxDeltaDepth || !get(hash, data) || !get(d.second, base)) continue;
+        {
+            VCSIM_TIMED(DELTA);
+            VCSIM_BYTES(DELTA, data.size());
+            delta = LineDelta::make(base, data);
+        }
+        if (delta.size() + DELTA_HEADER >= data.size() / 2) continue;
+        string header = "D" + d.second + char(depth + 1), prefix, packed;
+        out[PackFile::parseHash(hash)] = compress(delta, prefix, packed) ? prefix + header + packed : header + delta;
+        rebased[hash] = d.second;
+    }
+    return out;
+}
+
+bool ObjectStore::has(const string& hash) const {
+    if (fs::exists(objectPath(hash)) || inPacks(PackFile::parseHash(hash))) return true;
+    loadPacks();  // as in withObject()
+    return inPacks(PackFile::parseHash(hash)) || (fallback && fallback->has(hash));
+}
+
+vector<char> ObjectStore::hasEach(const vector<string>& hashes) const {
+    loadPacks();
+    vector<char> found(hashes.size());
+    for (size_t i = 0; i < hashes.size(); ++i)
+        found[i] = fs::exists(objectPath(hashes[i])) || inPacks(PackFile::parseHash(hashes[i]));
+    if (fallback) {
+        vector<char> below = fallback->hasEach(hashes);
+        for (size_t i = 0; i < hashes.size(); ++i) found[i] |= below[i];
+    }
+    return found;
+}
+
+bool ObjectStore::reuse(const string& hash) {
+    error_code ec;
+    fs::last_write_time(objectPath(hash), fs::file_time_type::clock::now(), ec);
+    return !ec || inPacks(PackFile::parseHash(hash));
+}
+
+bool ObjectStore::peek(const string& hash, char& kind, string& base) const {
+    return withObject(hash, [&](auto& src, size_t) {
+        Header h;
+        if (!readHeader(src, h)) return false;
+        kind = h.kind;
+        base = h.base;
+        return true;
+    });
+}
+
+size_t ObjectStore::estimateLoose() const {
+    size_t n = 0;
+    error_code ec;
+    for (fs::directory_iterator e(root + "/17", ec), end; !ec && e != end; e.increment(ec)) {
+        if (e->path().filename().string().size() == 14) ++n;
+    }
+    return n * 256;
+}
+
+bool ObjectStore::repack(const RepackPlan& plan, RepackResult& result) {
+    auto cancelled = [&] { return plan.cancel && plan.cancel->load(); };
+    auto dead = [&](uint64_t h) { return plan.live && !plan.live->count(h); };
+    shared_ptr<const PackList> old = packList();
+    unordered_map<uint64_t, string> redone = redeltify(plan);
+    // Where each object's bytes are: a loose file, or (when loose is
+    // empty) inside a pack in old, which stays mapped. They are read one
+    // at a time while the pack is written.
+    struct Source {
+        string loose;
+        string_view packed;
+    };
+    map<uint64_t, Source> all;
+    vector<fs::path> packedLoose, prunable;
+    forEachLoose([&](const string& hash, const fs::path& path) {
+        if (cancelled()) return;
+        uint64_t key = PackFile::parseHash(hash);
+        error_code ec;
+        if (dead(key)) {
+            if (fs::last_write_time(path, ec) < plan.pruneBefore && !ec) prunable.push_back(path);
+            return;
+        }
+        if (fs::file_size(path, ec) == 0 || ec) return;
+        all[key].loose = path.string();
+        packedLoose.push_back(path);
+    });
+    if (plan.mergePacks) {
+        for (const auto& p : *old) {
+            p->forEach([&](uint64_t h, string_view bytes) {
+                if (plan.prunePacked && dead(h)) ++result.pruned;
+                else all.emplace(h, Source{string(), bytes});
+            });
+        }
+    }
+    if (cancelled()) return false;
+
+    error_code ec;
+    string base;
+    if (!all.empty()) {
+        vector<uint64_t> hashes;
+        vector<const Source*> sources;
+        hashes.reserve(all.size());
+        sources.reserve(all.size());
+        string listing;
+        for (const auto& o : all) {
+            hashes.push_back(o.first);
+            sources.push_back(&o.second);
+            listing += ContentHash::hex(o.first);
+        }
+        fs::create_directories(root + "/pack", ec);
+        base = root + "/pack/pack-" + hashContent(listing);
+        bool written = PackFile::write(base, hashes, [&](size_t i, string& bytes) {
+            if (cancelled()) return false;
+            auto r = redone.find(hashes[i]);
+            if (r != redone.end()) {
+                bytes = move(r->second);
+                ++result.deltified;
+                return true;
+            }
+            if (sources[i]->loose.empty()) {
+                bytes.assign(sources[i]->packed.data(), sources[i]->packed.size());
+                return true;
+            }
+            ifstream in(sources[i]->loose, ios::binary);
+            bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+            return !bytes.empty();
+        });
+        if (!written) return false;
+        result.packed = hashes.size();
+        // The new pack is visible before anything it replaces goes away.
+        loadPacks();
+    }
+
+    unique_lock<shared_mutex> lock(removal);
+    if (plan.mergePacks) {
+        for (const auto& p : *old) {
+            if (p->path() == base) continue;
+            fs::remove(p->path() + ".idx", ec);
+            fs::remove(p->path() + ".pack", ec);
+        }
+    }
+    for (const fs::path& f : packedLoose) fs::remove(f, ec);
+    // Rechecked under the lock: put() may have just reused one.
+    for (const fs::path& f : prunable) {
+        if (fs::last_write_time(f, ec) < plan.pruneBefore && !ec && fs::remove(f, ec)) ++result.pruned;
+    }
+    for (fs::directory_iterator d(root, ec), end; !ec && d != end; d.increment(ec)) {
+        string name = d->path().filename().string();
+        if (name.size() == 2 && fs::is_empty(d->path(), ec)) fs::remove(d->path(), ec);
+#ifndef _WIN32
+        // A quarantine whose receiving process died before cleaning up.
+        else if (name.rfind("incoming-", 0) == 0 && kill(atoi(name.c_str() + 9), 0) != 0 && errno == ESRCH)
+            fs::remove_all(d->path(), ec);
+#endif
+    }
+    loadPacks();
+    return true;
+}
+
+string ObjectStore::put(string_view data, string hash) {
+    if (hash.empty()) hash = hashContent(data);
+    shared_lock<shared_mutex> lock(removal);
+    if (!reuse(hash) && !writeRaw(hash, "B", data)) return "";
+    return hash;
+}
+
+string ObjectStore::putDelta(const string& data, const string& baseHash, string hash) {
+    if (hash.empty()) hash = hashContent(data);
+    shared_lock<shared_mutex> lock(removal);
+    if (reuse(hash)) return hash;
+
+    int baseDepth = baseHash == hash ? -1 : depthOf(baseHash);
+    string base;
+    if (baseDepth >= 0 && baseDepth < maxDeltaDepth && get(baseHash, base)) {
+        string delta;
+        {
+            VCSIM_TIMED(DELTA);
+            VCSIM_BYTES(DELTA, data.size());
+            delta = LineDelta::make(base, data);
+        }
+        if (delta.size() + DELTA_HEADER < data.size() / 2)
+            return writeRaw(hash, "D" + baseHash + char(baseDepth + 1), delta) ? hash : "";
+    }
+    return writeRaw(hash, "B", data) ? hash : "";
+}
+
+bool ObjectStore::resolve(const string& hash, char kind, string base, string payload, string& out) const {
+    vector<string> deltas;
+    unordered_set<string> seen{hash};
+    while (kind == 'D') {
+        if (deltas.size() == MAX_CHAIN || !seen.insert(base).second) return false;
+        deltas.push_back(move(payload));
+        string at = move(base);
+        if (!readRaw(at, kind, base, payload)) return false;
+    }
+    if (kind != 'B') return false;
+    out = move(payload);
+    string next;
+    for (auto d = deltas.rbegin(); d != deltas.rend(); ++d) {
+        if (!LineDelta::apply(out, *d, next)) return false;
+        out.swap(next);
+    }
+    return true;
+}
+
+bool ObjectStore::getChunk(const string& hash, uint64_t size, string& out) const {
+    char kind;
+    string base, payload;
+    if (size > Chunker::MAX || !readRaw(hash, kind, base, payload) || kind == 'C') return false;
+    return resolve(hash, kind, move(base), move(payload), out) && out.size() == size;
+}
+
+bool ObjectStore::get(const string& hash, string& out) const {
+    char kind;
+    string baseHash, payload;
+    if (!readRaw(hash, kind, baseHash, payload)) return false;
+    if (kind != 'C') return resolve(hash, kind, move(baseHash), move(payload), out);
+    out.clear();
+    string data;
+    return forEachChunk(payload, [&](const string& chunk, uint64_t size) {
+        if (!getChunk(chunk, size, data)) return false;
+        out += data;
+        return true;
+    });
+}
+
+bool ObjectStore::stream(const string& hash, const function<bool(string_view)>& sink) const {
+    char kind;
+    string baseHash, payload;
+    if (!readRaw(hash, kind, baseHash, payload)) return false;
+    string data;
+    if (kind != 'C') return resolve(hash, kind, move(baseHash), move(payload), data) && sink(data);
+    return forEachChunk(payload, [&](const string& chunk, uint64_t size) {
+        return getChunk(chunk, size, data) && sink(data);
+    });
+}
+
+bool ObjectStore::rawBytes(const string& hash, string& out) const {
+    return withObject(hash, [&](auto& src, size_t size) {
+        out.resize(size);
+        VCSIM_TIMED(OBJECT_READ);
+        VCSIM_BYTES(OBJECT_READ, size);
+        return src.read(&out[0], size);
+    });
+}
+
+bool ObjectStore::putRaw(const string& hash, string_view bytes) {
+    ViewSource src{bytes};
+    Header h;
+    if (!isHash(hash) || !readHeader(src, h)) return false;
+    if (h.codec && h.rawSize > h.codec->maxRawSize(src.rest)) return false;
+    shared_lock<shared_mutex> lock(removal);
+    return reuse(hash) || writeObject(hash, {bytes});
+}
+
+bool ObjectStore::publish(const ObjectStore& quarantine) {
+    shared_lock<shared_mutex> lock(removal);
+    bool ok = true;
+    quarantine.forEachLoose([&](const string& hash, const fs::path& path) {
+        error_code ec;
+        fs::create_directories(root + "/" + hash.substr(0, 2), ec);
+        fs::rename(path, objectPath(hash), ec);
+        if (ec) ok = false;
+    });
+    return ok;
+}
+
+bool ObjectStore::verify(const string& hash) const {
+    ContentHash::Stream whole;
+    bool read = stream(hash, [&](string_view piece) {
+        VCSIM_TIMED(HASH);
+        VCSIM_BYTES(HASH, piece.size());
+        whole.update(piece);
+        return true;
+    });
+    return read && ContentHash::hex(whole.digest()) == hash;
+}
+
+bool ObjectStore::complete(const string& hash) const {
+    char kind;
+    string base;
+    if (!peek(hash, kind, base)) return false;
+    if (kind != 'C') return true;
+    for (const string& c : chunksOf(hash)) if (!has(c)) return false;
+    return true;
+}
+
+vector<string> ObjectStore::chunksOf(const string& hash) const {
+    char kind;
+    string baseHash, payload;
+    vector<string> chunks;
+    if (readRaw(hash, kind, baseHash, payload) && kind == 'C')
+        forEachChunk(payload, [&](const string& chunk, uint64_t) { chunks.push_back(chunk); return true; });
+    return chunks;
+}
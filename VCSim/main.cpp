@@ -0,0 +1,74 @@
+#include "Vcs_oops.h"
+
+#include <csignal>
+
+using namespace std;
+
+static void usage() {
+    cout << "Usage: vcsim                      interactive session\n"
+            "       vcsim --batch <file|->     run a command script as one transaction\n"
+            "       vcsim -c <command> ...     run the given commands as one transaction\n"
+            "       vcsim <command words>      run one command, e.g. vcsim add *.txt\n"
+            "       vcsim --serve <dir>        the far end of a push or pull, on stdin and stdout" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> script;
+    bool batch = false, single = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if ((arg == "--batch" || arg == "-b") && i + 1 < argc) {
+            string path = argv[++i];
+            ifstream file;
+            if (path != "-") {
+                file.open(path);
+                if (!file) { cout << "Cannot read " << path << endl; return 2; }
+            }
+            istream& in = path == "-" ? cin : file;
+            for (string line; getline(in, line);) script.push_back(line);
+            batch = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            // stdin and stdout carry the protocol, so messages go to stderr.
+            // A push to a directory that is not a repository yet makes one.
+            cout.rdbuf(cerr.rdbuf());
+#ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+#endif
+            error_code ec;
+            fs::create_directories(argv[++i], ec);
+            fs::current_path(argv[i], ec);
+            if (ec) { cerr << "Cannot open " << argv[i] << endl; return 2; }
+            Wire wire(0, 1);
+            return Repository::getInstance().serve(wire) ? 0 : 1;
+        } else if (arg == "-c" && i + 1 < argc) {
+            script.push_back(argv[++i]);
+            batch = true;
+        } else if (arg == "-h" || arg == "--help" || arg[0] == '-') {
+            usage();
+            return arg[0] == '-' && arg != "-h" && arg != "--help" ? 2 : 0;
+        } else {
+            // Remaining words form a single command; quote the ones with spaces.
+            string cmd;
+            for (; i < argc; ++i) {
+                string word = argv[i];
+                cmd += (cmd.empty() ? "" : " ") + (word.find(' ') == string::npos ? word : "\"" + word + "\"");
+            }
+            script.push_back(cmd);
+            batch = single = true;
+        }
+    }
+    if (batch) {
+        VCS vcs(cin, false);
+        return vcs.runBatch(script, single) ? 0 : 1;
+    }
+
+    VCS vcs;
+    string cmd;
+    cout << "Mini VCS running. Commands: add <file|dir>..., edit <file>, commit <msg>, log [--oneline] [--limit n] [--since date] [--grep text], status, diff <a> <b>, branch [<name>], push|pull <dir> [<branch>], stats, gc [--auto], checkout [--force] <id|branch>, exit" << endl;
+    while (true) {
+        cout << ">> ";
+        if (!getline(cin, cmd) || cmd == "exit") break;
+        vcs.runCommand(cmd);
+    }
+    return 0;
+}
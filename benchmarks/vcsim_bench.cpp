@@ -0,0 +1,241 @@
+// Throughput and memory benchmarks for the hot repository paths, run against
+// synthetic repositories (N files x M commits, with a chosen file size mix)
+// built in a scratch directory. Counters per run:
+//   allocs/iter, alloc_bytes/iter  heap allocations made by the measured code
+//   peak_rss_MB                    process peak resident set so far
+#include "Vcs_oops.h"
+
+#include <benchmark/benchmark.h>
+#include <new>
+#include <random>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+static atomic<uint64_t> allocCount(0), allocBytes(0);
+
+// Kept out of line: where GCC inlines them it sees malloc() meet operator
+// delete (or free() meet operator new) and warns of a mismatch.
+__attribute__((noinline)) void* operator new(size_t n) {
+    allocCount.fetch_add(1, memory_order_relaxed);
+    allocBytes.fetch_add(n, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace {
+
+// Repository and VCS print progress on cout; keep that out of the report.
+class Quiet {
+    streambuf* saved;
+    ostringstream sink;
+public:
+    Quiet() : saved(cout.rdbuf(sink.rdbuf())) {}
+    ~Quiet() { cout.rdbuf(saved); }
+};
+
+// Heap use of the measured loop, reported per iteration.
+class AllocMeter {
+    uint64_t count0 = allocCount, bytes0 = allocBytes;
+public:
+    void report(benchmark::State& state) const {
+        double iters = double(max<benchmark::IterationCount>(state.iterations(), 1));
+        state.counters["allocs/iter"] = double(allocCount - count0) / iters;
+        state.counters["alloc_bytes/iter"] = double(allocBytes - bytes0) / iters;
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        state.counters["peak_rss_MB"] = double(ru.ru_maxrss) / 1024.0;
+    }
+};
+
+// Size mixes: 0 = all 1 KiB, 1 = all 64 KiB, 2 = mostly small with a few
+// large files (1 in 16 is 256 KiB, the rest 512 B - 8 KiB).
+size_t fileSize(int mix, size_t i, mt19937& rng) {
+    if (mix == 0) return 1024;
+    if (mix == 1) return 64 * 1024;
+    if (i % 16 == 15) return 256 * 1024;
+    return 512 + rng() % (8 * 1024);
+}
+
+string makeContent(size_t size, uint32_t seed) {
+    string s;
+    s.reserve(size + 64);
+    mt19937 rng(seed);
+    while (s.size() < size) {
+        s += "line " + to_string(rng()) + " of synthetic benchmark content\n";
+    }
+    s.resize(size);
+    return s;
+}
+
+// Edits one line-sized region so deltas stay realistic.
+void touch(string& content, int iteration) {
+    string mark = "edit " + to_string(iteration) + "\n";
+    size_t at = content.size() / 2;
+    content.replace(at, min(mark.size(), content.size() - at), mark);
+}
+
+// N tracked files under their own directory, created and committed once.
+struct Dataset {
+    vector<shared_ptr<File>> files;
+    FileSet working;
+    size_t bytes = 0;
+    int edits = 0;  // benchmark runs repeat, so every edit needs a fresh mark
+};
+
+void editAll(Dataset& d) {
+    ++d.edits;
+    for (const auto& f : d.files) {
+        string content = f->getStagedContent();
+        touch(content, d.edits);
+        f->updateContent(move(content));
+        Repository::getInstance().addFile(f);
+    }
+}
+
+Dataset& dataset(const string& tag, size_t n, int mix) {
+    static map<string, Dataset> cache;
+    string key = tag + "_" + to_string(n) + "_" + to_string(mix);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    Dataset& d = cache[key];
+    Quiet quiet;
+    fs::create_directories(key);
+    mt19937 rng(uint32_t(n * 31 + mix));
+    Repository& repo = Repository::getInstance();
+    for (size_t i = 0; i < n; ++i) {
+        string path = key + "/f" + to_string(i) + ".txt";
+        string content = makeContent(fileSize(mix, i, rng), rng());
+        d.bytes += content.size();
+        auto f = make_shared<TextFile>(path, content);
+        f->markModified();
+        repo.addFile(f);
+        d.working.insert(f);
+        d.files.push_back(f);
+    }
+    repo.commit("seed " + key);
+    return d;
+}
+
+void BM_LoadFromDisk(benchmark::State& state) {
+    size_t size = size_t(state.range(0));
+    string path = "load_" + to_string(size) + ".txt";
+    File::writeBytes(path, makeContent(size, 7));
+    AllocMeter meter;
+    for (auto _ : state) {
+        shared_ptr<File> f = File::loadFromDisk(path);
+        benchmark::DoNotOptimize(f);
+    }
+    meter.report(state);
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(size));
+}
+BENCHMARK(BM_LoadFromDisk)->Arg(4 << 10)->Arg(1 << 20)->Arg(32 << 20);
+
+// One long line through XXH3; range(1) picks the scalar kernel (0) or the
+// one the CPU supports (1).
+void BM_FastHash(benchmark::State& state) {
+    string data = makeContent(size_t(state.range(0)), 11);
+    bool best = state.range(1) != 0;
+    for (auto _ : state) benchmark::DoNotOptimize(best ? FastHash::of(data) : FastHash::ofScalar(data));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(data.size()));
+}
+BENCHMARK(BM_FastHash)->ArgsProduct({{256, 4 << 10, 1 << 20}, {0, 1}});
+
+// Every file edited, then one commit.
+void BM_Commit(benchmark::State& state) {
+    size_t n = size_t(state.range(0));
+    int mix = int(state.range(1));
+    Dataset& d = dataset("commit", n, mix);
+    Repository& repo = Repository::getInstance();
+    Quiet quiet;
+    AllocMeter meter;
+    for (auto _ : state) {
+        state.PauseTiming();
+        editAll(d);
+        state.ResumeTiming();
+        if (!repo.commit("bench " + to_string(d.edits))) {
+            state.SkipWithError("commit failed");
+            break;
+        }
+    }
+    meter.report(state);
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(n));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(d.bytes));
+}
+BENCHMARK(BM_Commit)->ArgsProduct({{10, 100, 1000}, {0, 2}})->Unit(benchmark::kMillisecond);
+
+// Alternates between two commits that differ in every file.
+void BM_Checkout(benchmark::State& state) {
+    size_t n = size_t(state.range(0));
+    int mix = int(state.range(1));
+    Dataset& d = dataset("checkout", n, mix);
+    Repository& repo = Repository::getInstance();
+    Quiet quiet;
+    static map<Dataset*, pair<int, int>> targets;
+    if (!targets.count(&d)) {
+        int first = repo.head();
+        editAll(d);
+        repo.commit("checkout target");
+        targets[&d] = {first, repo.head()};
+    }
+    auto [first, second] = targets[&d];
+    bool toFirst = true;
+    AllocMeter meter;
+    for (auto _ : state) {
+        if (!repo.checkout(toFirst ? first : second, d.working)) {
+            state.SkipWithError("checkout failed");
+            break;
+        }
+        toFirst = !toFirst;
+    }
+    meter.report(state);
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(n));
+}
+BENCHMARK(BM_Checkout)->ArgsProduct({{10, 100, 1000}, {0, 2}})->Unit(benchmark::kMillisecond);
+
+// Walks M commits of history, one-line or full format.
+void BM_Log(benchmark::State& state) {
+    size_t m = size_t(state.range(0));
+    bool oneline = state.range(1) != 0;
+    Dataset& d = dataset("log", 1, 0);
+    Repository& repo = Repository::getInstance();
+    Quiet quiet;
+    while (size_t(d.edits) < m) {
+        editAll(d);
+        repo.commit("history " + to_string(d.edits));
+    }
+    LogOptions opts;
+    opts.limit = m;
+    opts.oneline = oneline;
+    AllocMeter meter;
+    for (auto _ : state) repo.log(opts);
+    meter.report(state);
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(m));
+}
+BENCHMARK(BM_Log)->ArgsProduct({{100, 1000}, {1, 0}})->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+// The repository lives in the working directory, so the suite runs inside a
+// scratch directory removed afterwards.
+int main(int argc, char** argv) {
+    fs::path root = fs::temp_directory_path() / ("vcsim-bench-" + to_string(getpid()));
+    fs::create_directories(root);
+    fs::current_path(root);
+    // Created before any benchmark's statics, so it is destroyed after them.
+    Repository::getInstance();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    fs::current_path(root.parent_path());
+    error_code ec;
+    fs::remove_all(root, ec);
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Round trips through the LZ4 codec: known blocks both ways, damaged
+// blocks refused, random input of every shape.
+#include "harness.h"
+
+using namespace std;
+
+static const Codec& lz4() { return *Codec::byName("lz4"); }
+
+TEST(Lz4Codec, DecodesKnownBlocks) {
+    struct { string block, raw; } cases[] = {
+        {bytes({0x00}), ""},
+        {bytes({0x50}) + "hello", "hello"},
+        // "abc", then 4 bytes copied from offset 3, then 5 literals
+        {bytes({0x30, 'a', 'b', 'c', 0x03, 0x00, 0x50}) + "bcabc", "abcabcabcabc"},
+        // 20 literals: 15 in the token plus one length byte
+        {bytes({0xF0, 0x05}) + "abcdefghijklmnopqrst", "abcdefghijklmnopqrst"},
+        // a 94-byte match overlapping its own output, length 15 + 75
+        {bytes({0x1F, 'a', 0x01, 0x00, 0x4B, 0x50}) + "aaaaa", string(100, 'a')},
+    };
+    for (const auto& c : cases) {
+        string out;
+        CHECK(lz4().decompress(c.block, c.raw.size(), out));
+        CHECK(out == c.raw);
+    }
+}
+
+TEST(Lz4Codec, EncodesKnownBlocks) {
+    string out;
+    REQUIRE(lz4().compress("", out));
+    CHECK(out == bytes({0x00}));
+    REQUIRE(lz4().compress("hello", out));
+    CHECK(out == bytes({0x50}) + "hello");
+    REQUIRE(lz4().compress(string(100, 'a'), out));
+    CHECK(out == bytes({0x1F, 'a', 0x01, 0x00, 0x4B, 0x50}) + "aaaaa");
+}
+
+TEST(Lz4Codec, RejectsDamagedBlocks) {
+    string out;
+    CHECK(!lz4().decompress(bytes({0x50}) + "hel", 5, out));           // literals cut short
+    CHECK(!lz4().decompress(bytes({0x50}) + "hello", 6, out));         // wrong recorded size
+    CHECK(!lz4().decompress(bytes({0x10, 'a', 0x02, 0x00}), 5, out));  // offset before the start
+    CHECK(!lz4().decompress(bytes({0x10, 'a', 0x00, 0x00}), 5, out));  // offset 0
+    CHECK(!lz4().decompress(bytes({0x10, 'a', 0x01}), 5, out));        // offset cut short
+}
+
+TEST(Lz4Codec, RoundTripsRandomInput) {
+    mt19937 rng(1);
+    for (int round = 0; round < 200; ++round) {
+        size_t n = rng() % (round < 150 ? 300 : 300000);
+        string in = randomBytes(rng, n, 1 + int(rng() % 256));
+        string packed, out;
+        REQUIRE(lz4().compress(in, packed));
+        REQUIRE(lz4().decompress(packed, in.size(), out));
+        REQUIRE(out == in);
+    }
+}
+
@@ -0,0 +1,266 @@
+// Commands as a user runs them: each test drives the vcsim binary in its
+// own empty directory and checks what it prints and leaves on disk.
+#include "harness.h"
+
+using namespace std;
+
+// Calls of a metric in the output of `stats --json`, 0 if it has none.
+static int calls(const Run& r, const string& metric) {
+    size_t at = r.out.find("\"" + metric + "\": {\"calls\": ");
+    return at == string::npos ? 0 : stoi(r.out.substr(at + metric.size() + 13));
+}
+
+// Backdates files, as if written long ago: stat data is trusted only for
+// files that have not changed in the last couple of seconds.
+static void age(const vector<string>& paths) {
+    for (const string& p : paths) fs::last_write_time(p, fs::last_write_time(p) - chrono::hours(1));
+}
+
+TEST(Diff, ShowsChangedAndAddedFilesBetweenCommits) {
+    writeFile("a.txt", "a\nb\nc\n");
+    writeFile("b.bin", bytes({0, 1, 'x'}));
+    REQUIRE(batch("add .\ncommit one\nbranch base\n").ok());
+    writeFile("a.txt", "a\nB\nc\n");
+    writeFile("b.bin", bytes({0, 2, 'x'}));
+    writeFile("n.txt", "new\n");
+    REQUIRE(batch("add a.txt b.bin n.txt\ncommit two\n").ok());
+
+    Run r = vcsim({"diff", "base", "2"});
+    CHECK(r.ok());
+    CHECK(r.says("--- a/a.txt\n+++ b/a.txt\n@@ -1,3 +1,3 @@\n a\n-b\n+B\n c\n"));
+    CHECK(r.says("Binary files a/b.bin and b/b.bin differ"));
+    CHECK(r.says("--- /dev/null\n+++ b/n.txt\n@@ -0,0 +1,1 @@\n+new\n"));
+    // Reversed, the new file goes away again.
+    CHECK(vcsim({"diff", "2", "1"}).says("--- a/n.txt\n+++ /dev/null\n"));
+}
+
+TEST(Diff, SameCommitHasNoDifferences) {
+    writeFile("a.txt", "a\n");
+    REQUIRE(batch("add a.txt\ncommit one\n").ok());
+    Run r = vcsim({"diff", "1", "1"});
+    CHECK(r.ok() && r.says("No differences."));
+}
+
+TEST(Diff, UnknownCommitFails) {
+    writeFile("a.txt", "a\n");
+    REQUIRE(batch("add a.txt\ncommit one\n").ok());
+    CHECK(!vcsim({"diff", "1", "9"}).ok());
+    CHECK(!vcsim({"diff", "1", "nosuchbranch"}).ok());
+}
+
+TEST(Checkout, WritesOnlyTheFilesThatDiffer) {
+    for (int i = 0; i < 5; ++i) writeFile("f" + to_string(i) + ".txt", to_string(i) + "\n");
+    REQUIRE(batch("add .\ncommit one\n").ok());
+    writeFile("f2.txt", "changed\n");
+    writeFile("d/new.txt", "new\n");
+    REQUIRE(batch("add f2.txt d/new.txt\ncommit two\n").ok());
+    auto untouched = fs::last_write_time("f0.txt");
+
+    Run r = vcsim({"checkout", "1"});
+    CHECK(r.ok() && r.says("1 of 5 files written, 1 removed."));
+    CHECK(readFile("f2.txt") == "2\n");
+    CHECK(!fs::exists("d"));
+    CHECK(fs::last_write_time("f0.txt") == untouched);
+    CHECK(vcsim({"checkout", "1"}).says("0 of 5 files written."));
+
+    r = vcsim({"checkout", "2"});
+    CHECK(r.ok() && r.says("2 of 6 files written."));
+    CHECK(readFile("f2.txt") == "changed\n" && readFile("d/new.txt") == "new\n");
+    CHECK(vcsim({"checkout", "--force", "2"}).says("6 of 6 files written."));
+}
+
+TEST(Checkout, TakesAFullOrShortCommitHash) {
+    writeFile("a.txt", "one\n");
+    REQUIRE(batch("add a.txt\ncommit one\nedit a.txt\ntwo\ncommit two\n").ok());
+    // log lists commit 1 last.
+    string log = vcsim({"log"}).out;
+    size_t at = log.rfind("Hash: ");
+    REQUIRE(at != string::npos);
+    string hash = log.substr(at + 6, 16);
+
+    CHECK(vcsim({"diff", hash, "2"}).says("-one\n+two"));
+    Run r = vcsim({"checkout", hash.substr(0, 6)});
+    CHECK(r.ok() && r.says("Checked out commit 1"));
+    CHECK(readFile("a.txt") == "one\n");
+    CHECK(!vcsim({"checkout", "abcdefabcdef"}).ok());
+}
+
+TEST(Status, ReportsEditsAndRereadsOnlyFilesWhoseStatChanged) {
+    vector<string> files = {"f1.txt", "f2.txt", "d/f3.txt"};
+    for (const string& f : files) writeFile(f, f + "\n");
+    REQUIRE(batch("add .\ncommit one\n").ok());
+    age(files);
+    Run r = vcsim({"-c", "status"});
+    CHECK(r.says("Nothing to commit, working tree clean."));
+    r = vcsim({"-c", "status", "-c", "stats --json"});
+    CHECK(r.says("working tree clean") && calls(r, "hash") == 0);
+
+    writeFile("f2.txt", "edited\n");
+    fs::remove("d/f3.txt");
+    age({"f2.txt"});
+    r = vcsim({"-c", "status", "-c", "stats --json"});
+    CHECK(r.says("Changes on disk not yet added:\n  deleted:  d/f3.txt\n  modified: f2.txt\n"));
+    CHECK(calls(r, "hash") == 1);
+    r = vcsim({"-c", "status", "-c", "stats --json"});
+    CHECK(r.says("  modified: f2.txt") && calls(r, "hash") == 0);
+}
+
+TEST(Log, FiltersByMessageDateAndCount) {
+    writeFile("a.txt", "a\n");
+    REQUIRE(batch("add a.txt\ncommit fix parser\nedit a.txt\nb\ncommit add feature\nedit a.txt\nc\ncommit fix lexer\n").ok());
+
+    CHECK(vcsim({"log", "--oneline"}).out == "3 fix lexer\n2 add feature\n1 fix parser\n");
+    CHECK(vcsim({"log", "--oneline", "--grep", "fix"}).out == "3 fix lexer\n1 fix parser\n");
+    CHECK(vcsim({"log", "--oneline", "--grep", "fix", "--limit", "1"}).out == "3 fix lexer\n");
+    CHECK(vcsim({"log", "--oneline", "--since", "2000-01-01"}).out == "3 fix lexer\n2 add feature\n1 fix parser\n");
+    Run r = vcsim({"log", "--since", "2099-01-01"});
+    CHECK(r.ok() && r.out == "No matching commits.\n");
+    r = vcsim({"log"});
+    CHECK(r.says("Commit 2: add feature at ") && r.says("[TextFile] a.txt: b\n"));
+
+    CHECK(!vcsim({"log", "--limit", "x"}).ok());
+    CHECK(!vcsim({"log", "--since", "someday"}).ok());
+    CHECK(!vcsim({"log", "--bogus"}).ok());
+}
+
+TEST(Add, TakesDirectoriesAndGlobsAndHonoursVcsignore) {
+    writeFile(".vcsignore", "*.o\nbuild/\n");
+    writeFile("src/a.c", "a\n");
+    writeFile("src/a.o", "object\n");
+    writeFile("src/sub/b.c", "b\n");
+    writeFile("build/out.c", "generated\n");
+    writeFile("x.txt", "x\n");
+    writeFile("y.txt", "y\n");
+    writeFile("y.md", "y\n");
+
+    Run r = batch("add src *.txt\ncommit one\n");
+    REQUIRE(r.ok());
+    CHECK(r.says("Added 2 files under src to staging (2 changed)."));
+    string log = vcsim({"log"}).out;
+    for (const char* path : {"src/a.c", "src/sub/b.c", "x.txt", "y.txt"})
+        CHECK(log.find(string("[TextFile] ") + path + ":") != string::npos);
+    for (const char* path : {"src/a.o", "build/out.c", "y.md"}) CHECK(log.find(path) == string::npos);
+
+    // Nothing is run when a path or glob in the script matches nothing.
+    r = batch("add *.none\ncommit two\n");
+    CHECK(!r.ok() && r.says("Nothing was run."));
+}
+
+TEST(Gc, KeepsWhatAnyBranchReachesAndRemovesTheRest) {
+    writeFile("a.txt", "one\n");
+    REQUIRE(batch("add a.txt\ncommit one\nbranch side\ncheckout side\n").ok());
+    writeFile("s.txt", "only on side\n");
+    REQUIRE(batch("add s.txt\ncommit side\ncheckout main\n").ok());
+    writeFile("a.txt", "two\n");
+    REQUIRE(batch("add a.txt\ncommit two\n").ok());
+    writeFile("lost.txt", "never recorded\n");
+    // The batch fails after its commit stored objects, which nothing names.
+    REQUIRE(!batch("add lost.txt\ncommit three\nlog --bogus\n").ok());
+
+    Run r = vcsim({"gc"});
+    CHECK(r.ok() && r.says("removed 2 unreachable."));
+    CHECK(vcsim({"gc"}).says("removed 0 unreachable."));
+
+    r = vcsim({"log"});
+    CHECK(r.says("[TextFile] a.txt: two\n") && r.says("[TextFile] a.txt: one\n"));
+    REQUIRE(vcsim({"checkout", "side"}).ok());
+    CHECK(readFile("s.txt") == "only on side\n" && readFile("a.txt") == "one\n");
+    REQUIRE(vcsim({"checkout", "main"}).ok());
+    CHECK(readFile("a.txt") == "two\n" && !fs::exists("s.txt"));
+}
+
+TEST(Log, FailsCleanlyWhenAnObjectIsItsOwnDeltaBase) {
+    writeFile("a.txt", "x\n");
+    REQUIRE(batch("add a.txt\ncommit one\n").ok());
+    // Store objects are plain files (this one small enough to stay loose).
+    string blob = ContentHash::hex(ContentHash::of("x\n"));
+    string path = ".vcs/objects/" + blob.substr(0, 2) + "/" + blob.substr(2);
+    REQUIRE(fs::exists(path));
+    fs::permissions(path, fs::perms::owner_write, fs::perm_options::add);
+    writeFile(path, "D" + blob + char(1));
+    Run r = vcsim({"log"});
+    CHECK(r.status == 0 || r.status == 1);
+    CHECK(!r.says("[TextFile] a.txt: x"));
+}
+
+TEST(Staging, LastsFromOneCommandToTheNext) {
+    writeFile("a.txt", "a\n");
+    writeFile("b.txt", "b\n");
+    REQUIRE(vcsim({"add", "a.txt", "b.txt"}).ok());
+    CHECK(vcsim({"status"}).says("Changes to be committed:\n  modified: a.txt\n  modified: b.txt\n"));
+    Run r = vcsim({"commit", "first"});
+    CHECK(r.ok() && r.says("Commit done!"));
+    CHECK(vcsim({"log"}).says("[TextFile] b.txt: b\n"));
+    CHECK(vcsim({"status"}).says("working tree clean"));
+
+    // Edits made with the tool are kept too, and gc keeps what they hold.
+    writeFile("a.txt", "changed\n");
+    REQUIRE(vcsim({"add", "a.txt"}).ok());
+    REQUIRE(vcsim({"-c", "edit a.txt", "-c", "edited"}).ok());
+    REQUIRE(vcsim({"gc"}).ok());
+    REQUIRE(vcsim({"commit", "second"}).ok());
+    CHECK(readFile("a.txt") == "edited");
+    CHECK(vcsim({"log", "--limit", "1"}).says("[TextFile] a.txt: edited"));
+    CHECK(vcsim({"commit", "nothing"}).says("No edited files to commit!"));
+}
+
+TEST(Staging, SingleCommandsReportTheirOwnFailures) {
+    writeFile("a.txt", "a\n");
+    REQUIRE(vcsim({"add", "a.txt"}).ok());
+    Run r = vcsim({"diff", "1", "9"});
+    CHECK(!r.ok() && !r.says("Batch"));
+    r = vcsim({"add", "missing.txt"});
+    CHECK(!r.ok() && r.out == "No file matches missing.txt.\n");
+    CHECK(batch("diff 1 9\n").says("Batch failed: command 'diff 1 9'."));
+}
+
+TEST(Commit, LeavesFilesThatAlreadyHoldTheCommitAlone) {
+    vector<string> files;
+    for (int i = 0; i < 20; ++i) {
+        files.push_back("d/f" + to_string(i) + ".txt");
+        writeFile(files.back(), to_string(i) + "\n");
+    }
+    age(files);
+    auto before = fs::last_write_time(files[0]);
+    Run r = vcsim({"-c", "add d", "-c", "commit one", "-c", "stats --json"});
+    CHECK(r.says("Commit done!"));
+    CHECK(calls(r, "file.write") == 0);
+    CHECK(fs::last_write_time(files[0]) == before);
+
+    // An edit made with the tool is what reaches the disk.
+    r = vcsim({"-c", "add d/f1.txt", "-c", "edit d/f1.txt", "-c", "new", "-c", "commit two", "-c", "stats --json"});
+    CHECK(r.ok() && calls(r, "file.write") == 1);
+    CHECK(readFile("d/f1.txt") == "new");
+}
+
+TEST(Commit, RefusesToOverwriteAnEditMadeOnDiskAfterAdd) {
+    writeFile("a.txt", "orig\n");
+    REQUIRE(vcsim({"add", "a.txt"}).ok());
+    writeFile("a.txt", "USER EDIT\n");
+    Run r = vcsim({"commit", "msg"});
+    CHECK(!r.ok() && r.says("a.txt changed on disk since it was added; add it again."));
+    CHECK(readFile("a.txt") == "USER EDIT\n");
+    CHECK(vcsim({"log"}).says("No commits yet."));
+    CHECK(vcsim({"status"}).says("Changes on disk not yet added:\n  modified: a.txt\n"));
+
+    REQUIRE(vcsim({"add", "a.txt"}).ok());
+    REQUIRE(vcsim({"commit", "msg"}).ok());
+    CHECK(readFile("a.txt") == "USER EDIT\n");
+    CHECK(vcsim({"log"}).says("[TextFile] a.txt: USER EDIT\n"));
+}
+
+TEST(Commit, StoresOnlyTheDirectoriesItChanges) {
+    for (int i = 0; i < 20; ++i) writeFile("d" + to_string(i) + "/f.txt", to_string(i) + "\n");
+    REQUIRE(batch("add .\ncommit one\n").ok());
+    writeFile("d0/f.txt", "changed\n");
+    // The edited file, d0/ and the top tree are hashed; the other 19
+    // directories are the parent's.
+    Run r = batch("add d0/f.txt\ncommit two\nstats --json\n");
+    CHECK(r.ok() && calls(r, "hash") <= 3);
+
+    string log = vcsim({"log", "--limit", "1"}).out;
+    CHECK(log.find("[TextFile] d0/f.txt: changed") != string::npos && log.find("d1/") == string::npos);
+    CHECK(vcsim({"diff", "1", "2"}).says("--- a/d0/f.txt\n+++ b/d0/f.txt\n"));
+    REQUIRE(vcsim({"checkout", "1"}).says("1 of 20 files written."));
+    CHECK(readFile("d0/f.txt") == "0\n" && readFile("d19/f.txt") == "19\n");
+}
@@ -0,0 +1,138 @@
+// The harness behind TEST/CHECK, the shared test data helpers and main().
+// `vcsim_tests <name>...` runs only the named tests.
+#include "harness.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+vector<Test>& tests() {
+    static vector<Test> all;
+    return all;
+}
+
+Register::Register(const char* name, void (*run)()) { tests().push_back({name, run}); }
+
+static int failures = 0;
+static string lastRun;  // output of the latest vcsim() in this test
+
+bool report(bool ok, const char* expr, const char* file, int line) {
+    if (!ok) {
+        cerr << file << ":" << line << ": failed: " << expr << endl;
+        if (!lastRun.empty()) cerr << "  vcsim said:\n" << lastRun;
+        ++failures;
+    }
+    return ok;
+}
+
+string bytes(initializer_list<int> values) {
+    string s;
+    for (int v : values) s += char(v);
+    return s;
+}
+
+string randomBytes(mt19937& rng, size_t n, int alphabet) {
+    string s(n, '\0');
+    for (char& c : s) c = char(rng() % alphabet);
+    return s;
+}
+
+string randomLines(mt19937& rng, size_t lines) {
+    string s;
+    for (size_t i = 0; i < lines; ++i) s += "line " + to_string(rng() % 50) + "\n";
+    return s;
+}
+
+string editLines(mt19937& rng, const string& text) {
+    vector<string> lines;
+    istringstream in(text);
+    for (string line; getline(in, line);) lines.push_back(line);
+    for (int k = rng() % 6; k > 0; --k) {
+        size_t at = lines.empty() ? 0 : rng() % lines.size();
+        switch (rng() % 3) {
+        case 0: if (!lines.empty()) lines.erase(lines.begin() + at); break;
+        case 1: lines.insert(lines.begin() + at, "new " + to_string(rng())); break;
+        default: if (!lines.empty()) lines[at] += " changed"; break;
+        }
+    }
+    string out;
+    for (const string& line : lines) out += line + "\n";
+    if (!out.empty() && rng() % 4 == 0) out.pop_back();  // no final newline
+    return out;
+}
+
+string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+void writeFile(const string& path, const string& content) {
+    fs::path parent = fs::path(path).parent_path();
+    if (!parent.empty()) fs::create_directories(parent);
+    ofstream(path, ios::binary) << content;
+}
+
+// stdin and the captured output go through files beside the test
+// directories, never inside the working tree the command looks at.
+Run vcsim(const vector<string>& args, const string& input) {
+    string io = (fs::current_path().parent_path() / "vcsim-io").string();
+    writeFile(io + ".in", input);
+    vector<string> words = {VCSIM_BINARY};
+    words.insert(words.end(), args.begin(), args.end());
+    vector<char*> argv;
+    for (string& w : words) argv.push_back(w.data());
+    argv.push_back(nullptr);
+    string in = io + ".in", out = io + ".out";
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int i = open(in.c_str(), O_RDONLY);
+        int o = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (i < 0 || o < 0) _exit(126);
+        dup2(i, 0);
+        dup2(o, 1);
+        dup2(o, 2);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    Run run;
+    int status = 0;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid)
+        run.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    run.out = readFile(out);
+    lastRun = run.out;
+    return run;
+}
+
+Run batch(const string& script) { return vcsim({"--batch", "-"}, script); }
+
+int main(int argc, char** argv) {
+    set<string> only(argv + 1, argv + argc);
+    fs::path root = fs::temp_directory_path() / ("vcsim-test-" + to_string(getpid()));
+    fs::create_directories(root);
+    int ran = 0;
+    {
+        // Quiet: Repository and VCS report progress on cout.
+        ostringstream sink;
+        streambuf* saved = cout.rdbuf(sink.rdbuf());
+        for (const Test& t : tests()) {
+            if (!only.empty() && !only.count(t.name)) continue;
+            fs::path dir = root / t.name;
+            fs::create_directories(dir);
+            fs::current_path(dir);
+            int before = failures;
+            lastRun.clear();
+            t.run();
+            cerr << (failures == before ? "ok      " : "FAILED  ") << t.name << endl;
+            ++ran;
+        }
+        cout.rdbuf(saved);
+    }
+    fs::current_path(root.parent_path());
+    error_code ec;
+    fs::remove_all(root, ec);
+    if (ran == 0) cerr << "no tests matched" << endl;
+    return failures == 0 && ran > 0 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+// Just enough of a test harness for the vcsim suite: TEST registers a
+// function, CHECK records a failure and carries on, REQUIRE also returns
+// from the test. Each test starts in an empty directory of its own, which
+// main() removes afterwards, so a test may create a repository right there,
+// either in-process (Repository is a per-process singleton, so at most one
+// test does that) or by running the vcsim binary with vcsim() or batch().
+#pragma once
+
+#include "Vcs_oops.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+std::vector<Test>& tests();
+
+struct Register {
+    Register(const char* name, void (*run)());
+};
+
+// Counts a failure and says where it was (and what the last vcsim() run
+// printed); returns ok.
+bool report(bool ok, const char* expr, const char* file, int line);
+
+#define TEST(suite, name)                                                           \
+    static void suite##_##name();                                                   \
+    static const Register suite##_##name##_registered(#suite "." #name, suite##_##name); \
+    static void suite##_##name()
+#define CHECK(cond) report(bool(cond), #cond, __FILE__, __LINE__)
+#define REQUIRE(cond) do { if (!report(bool(cond), #cond, __FILE__, __LINE__)) return; } while (0)
+
+// Test data.
+std::string bytes(std::initializer_list<int> values);
+// Drawn from the first alphabet byte values; small alphabets repeat a lot.
+std::string randomBytes(std::mt19937& rng, size_t n, int alphabet);
+std::string randomLines(std::mt19937& rng, size_t lines);
+// Deletes, inserts and rewrites a few lines of text.
+std::string editLines(std::mt19937& rng, const std::string& text);
+
+std::string readFile(const std::string& path);
+// Creates the parent directories as needed.
+void writeFile(const std::string& path, const std::string& content);
+
+// One run of the vcsim binary in the current directory.
+struct Run {
+    int status = -1;
+    std::string out;  // stdout and stderr together
+    bool ok() const { return status == 0; }
+    bool says(const std::string& text) const { return out.find(text) != std::string::npos; }
+};
+Run vcsim(const std::vector<std::string>& args, const std::string& input = "");
+// `vcsim --batch -` with the script's lines on stdin.
+Run batch(const std::string& script);
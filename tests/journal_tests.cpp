@@ -0,0 +1,138 @@
+// The commit log's hash index, and the commit journal: its record format
+// and recovery after a crash part-way through a commit.
+#include "harness.h"
+
+using namespace std;
+
+TEST(Journal, ParsesWhatItSerializes) {
+    Journal j;
+    j.record.id = 7;
+    j.record.parent = 6;
+    j.record.timestamp = 1700000000;
+    j.record.tree = "0123456789abcdef";
+    j.branch = "main";
+    j.message = "two\nlines";
+    j.files.push_back(Journal::Entry{"dir/a file.txt", "fedcba9876543210", 42});
+    string text = j.serialize();
+
+    Journal back;
+    REQUIRE(back.parse(text));
+    CHECK(back.record.id == 7u);
+    CHECK(back.record.parent == 6u);
+    CHECK(back.record.timestamp == 1700000000);
+    CHECK(back.record.tree == j.record.tree);
+    CHECK(back.branch == "main");
+    CHECK(back.message == j.message);
+    REQUIRE(back.files.size() == 1u);
+    CHECK(back.files[0].path == "dir/a file.txt");
+    CHECK(back.files[0].blob == "fedcba9876543210");
+    CHECK(back.files[0].hash == 42u);
+
+    string damaged = text;
+    damaged[20] ^= 1;
+    CHECK(!back.parse(damaged));
+    CHECK(!back.parse(text.substr(0, text.size() - 1)));
+}
+
+TEST(CommitLog, FindsCommitsByFullAndShortHash) {
+    fs::create_directories(".vcs");
+    vector<string> hashes(1);
+    {
+        CommitLog log;
+        REQUIRE(log.open(".vcs"));
+        for (uint64_t id = 1; id <= 2000; ++id) {
+            CommitLog::Record r;
+            r.id = id;
+            r.parent = id - 1;
+            r.timestamp = 1700000000 + int64_t(id);
+            r.tree = "0123456789abcdef";
+            string message = "commit " + to_string(id);
+            REQUIRE(log.append(r, message));
+            hashes.push_back(ContentHash::hex(CommitLog::hashOf(r, message)));
+        }
+    }
+    // Two of this many share their first four digits.
+    map<string, int> byShort;
+    string shared;
+    for (size_t id = 1; id < hashes.size() && shared.empty(); ++id) {
+        if (!byShort.emplace(hashes[id].substr(0, 4), int(id)).second) shared = hashes[id].substr(0, 4);
+    }
+    REQUIRE(!shared.empty());
+
+    CommitLog log;
+    REQUIRE(log.open(".vcs"));
+    CHECK(log.findHash(hashes[5]) == 5);
+    CHECK(log.findHash(hashes[1234].substr(0, 10)) == 1234);
+    CHECK(log.findHash(shared) == -1);
+    CHECK(log.findHash(hashes[7].substr(0, 3)) == 0);
+    CHECK(log.findHash("not a hash") == 0);
+    CHECK(fs::exists(".vcs/commits.hash"));
+
+    // Records appended later are found too, whether or not they are on disk
+    // yet.
+    CommitLog::Record r;
+    r.id = 2001;
+    r.parent = 2000;
+    r.timestamp = 1800000000;
+    r.tree = "fedcba9876543210";
+    string later = ContentHash::hex(CommitLog::hashOf(r, "later"));
+    log.beginBatch();
+    REQUIRE(log.append(r, "later"));
+    CHECK(log.findHash(later) == 2001);
+    REQUIRE(log.commitBatch());
+    CHECK(log.findHash(later) == 2001);
+    CommitLog reopened;
+    REQUIRE(reopened.open(".vcs"));
+    CHECK(reopened.findHash(later) == 2001 && reopened.findHash(hashes[2000]) == 2000);
+}
+
+// What a commit that crashed right after syncing its journal leaves behind:
+// its objects, the journal and, when pendingWritten, the new working file
+// beside its target. The log does not have the commit yet.
+static void crashCommit(int id, const string& content, bool pendingWritten) {
+    ObjectStore store(".vcs/objects");
+    string blob = store.put(content);
+    string tree = store.put(blob + " a.txt\n");
+    if (pendingWritten) REQUIRE(File::writeBytes(File::pendingPath("a.txt"), string_view(content)));
+    Journal j;
+    j.record.id = id;
+    j.record.parent = id - 1;
+    j.record.timestamp = time(nullptr);
+    j.record.tree = tree;
+    j.branch = "main";
+    j.message = "commit " + to_string(id);
+    j.files.push_back(Journal::Entry{"a.txt", blob, ContentHash::of(content)});
+    REQUIRE(j.write(".vcs/journal"));
+}
+
+// One test, as the repository is a per-process singleton.
+TEST(Journal, RecoveryFinishesCompleteCommitsAndDiscardsTheRest) {
+    Repository& repo = Repository::getInstance();
+    auto f = make_shared<TextFile>("a.txt", "one\n");
+    f->markModified();
+    repo.addFile(f, false);
+    REQUIRE(repo.commit("first"));
+    REQUIRE(repo.head() == 1);
+
+    // The working file never made it: the commit is dropped. Recovery runs
+    // when the next writer takes the lock.
+    crashCommit(2, "two\n", false);
+    REQUIRE(repo.createBranch("b1", 1));
+    CHECK(repo.head() == 1);
+    CHECK(repo.findCommit(2) == nullptr);
+    CHECK(readFile("a.txt") == "one\n");
+    CHECK(!fs::exists(".vcs/journal"));
+
+    // Everything is there: the commit is finished.
+    crashCommit(2, "two\n", true);
+    REQUIRE(repo.createBranch("b2", 1));
+    CHECK(repo.head() == 2);
+    shared_ptr<const Commit> c = repo.findCommit(2);
+    REQUIRE(c != nullptr);
+    CHECK(c->getMessage() == "commit 2");
+    CHECK(c->getParent() == 1);
+    CHECK(readFile("a.txt") == "two\n");
+    CHECK(!fs::exists(File::pendingPath("a.txt")));
+    CHECK(!fs::exists(".vcs/journal"));
+}
+
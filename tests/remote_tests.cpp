@@ -0,0 +1,65 @@
+// push and pull between two working trees through a third repository, the
+// remote being a local directory served by a child vcsim.
+#include "harness.h"
+
+using namespace std;
+
+// Runs the rest of the test in dir, made if need be.
+static void in(const fs::path& dir) {
+    fs::create_directories(dir);
+    fs::current_path(dir);
+}
+
+TEST(Remote, PushAndPullCarryTheHistoryBothWays) {
+    fs::path top = fs::current_path();
+    in(top / "a");
+    writeFile("a.txt", "one\n");
+    REQUIRE(batch("add a.txt\ncommit one\n").ok());
+    Run r = vcsim({"push", "../remote"});
+    CHECK(r.ok() && r.says("Pushed 1 commits and 2 objects"));
+
+    in(top / "b");
+    r = vcsim({"pull", "../remote", "main"});
+    CHECK(r.ok() && r.says("Pulled 1 commits"));
+    CHECK(readFile("a.txt") == "one\n");
+    writeFile("a.txt", "two\n");
+    REQUIRE(batch("add a.txt\ncommit two\n").ok());
+    REQUIRE(vcsim({"push", "../remote"}).ok());
+
+    in(top / "a");
+    r = vcsim({"pull", "../remote"});
+    CHECK(r.ok() && r.says("Pulled 1 commits") && r.says("main is at commit 2."));
+    CHECK(readFile("a.txt") == "two\n");
+    CHECK(vcsim({"log", "--oneline"}).out == "2 two\n1 one\n");
+    CHECK(vcsim({"pull", "../remote"}).says("Pulled 0 commits and 0 objects"));
+}
+
+TEST(Remote, RefusesDivergedHistories) {
+    fs::path top = fs::current_path();
+    in(top / "a");
+    writeFile("a.txt", "one\n");
+    REQUIRE(batch("add a.txt\ncommit one\n").ok());
+    REQUIRE(vcsim({"push", "../remote"}).ok());
+    in(top / "b");
+    REQUIRE(vcsim({"pull", "../remote", "main"}).ok());
+    writeFile("b.txt", "b\n");
+    REQUIRE(batch("add b.txt\ncommit from b\n").ok());
+    REQUIRE(vcsim({"push", "../remote"}).ok());
+
+    in(top / "a");
+    writeFile("c.txt", "c\n");
+    REQUIRE(batch("add c.txt\ncommit from a\n").ok());
+    Run r = vcsim({"push", "../remote"});
+    CHECK(!r.ok() && r.says("the histories have diverged"));
+    r = vcsim({"pull", "../remote"});
+    CHECK(!r.ok() && r.says("the histories have diverged"));
+    CHECK(vcsim({"log", "--oneline"}).out == "2 from a\n1 one\n");
+}
+
+TEST(Remote, RefusesAHostThatLooksLikeAnOption) {
+    writeFile("a.txt", "one\n");
+    REQUIRE(batch("add a.txt\ncommit one\n").ok());
+    Run r = vcsim({"push", "-oProxyCommand=touch pwned:dir"});
+    CHECK(!r.ok() && r.says("Not a host name"));
+    CHECK(!fs::exists("pwned"));
+}
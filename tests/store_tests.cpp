@@ -0,0 +1,226 @@
+// Line hashes, line deltas, chunk boundaries, pack files and the objects the store keeps
+// in them.
+#include "harness.h"
+
+using namespace std;
+
+// Values from the reference XXH3_64bits, one length for each of its paths.
+TEST(FastHash, MatchesReferenceXxh3) {
+    vector<pair<size_t, uint64_t>> known = {
+        {0, 0x2D06800538D394C2ULL},   {3, 0xC3489259E968AD9EULL},   {8, 0xB88DEE77F6BF6980ULL},
+        {16, 0x9DA23836ADF2BE1EULL},  {100, 0x1023AE92E631EAC5ULL}, {200, 0xD12016B53C9565BAULL},
+        {1000, 0xD1EB8367BF3294E7ULL}, {5000, 0xCE29A19460EE1BFCULL},
+    };
+    for (const auto& k : known) {
+        string s;
+        for (size_t i = 0; i < k.first; ++i) s += char(i * 7 % 251);
+        CHECK(FastHash::of(s) == k.second);
+        CHECK(FastHash::ofScalar(s) == k.second);
+    }
+}
+
+// Whichever kernel the CPU picked (vectorized() says which), through every
+// stripe and block boundary of the first few blocks.
+TEST(FastHash, VectorKernelAgreesWithScalar) {
+    mt19937 rng(19);
+    string data = randomBytes(rng, 4200, 256);
+    for (size_t n = 0; n <= data.size(); ++n) {
+        string_view s(data.data(), n);
+        REQUIRE(FastHash::of(s) == FastHash::ofScalar(s));
+    }
+}
+
+TEST(LineDelta, AppliesWhatItMakes) {
+    vector<pair<string, string>> cases = {
+        {"", ""}, {"", "a\n"}, {"a\n", ""}, {"a\nb\n", "a\nb"}, {"no newline", "no newline either"}, {"same\n", "same\n"},
+    };
+    mt19937 rng(2);
+    for (int i = 0; i < 300; ++i) {
+        string base = randomLines(rng, rng() % 200);
+        cases.emplace_back(base, editLines(rng, base));
+    }
+    for (const auto& c : cases) {
+        string delta = LineDelta::make(c.first, c.second), out;
+        REQUIRE(LineDelta::apply(c.first, delta, out));
+        REQUIRE(out == c.second);
+    }
+}
+
+TEST(PackFile, FindsEveryObjectWritten) {
+    mt19937_64 rng(3);
+    map<uint64_t, string> objects;
+    objects[0] = "first fanout bucket";
+    objects[~uint64_t(0)] = "last fanout bucket";
+    while (objects.size() < 500) objects[rng()] = string(rng() % 100, char('a' + rng() % 26));
+    vector<uint64_t> hashes;
+    for (const auto& o : objects) hashes.push_back(o.first);
+    bool written = PackFile::write("pack-test", hashes, [&](size_t i, string& out) {
+        out = objects[hashes[i]];
+        return true;
+    });
+    REQUIRE(written);
+
+    PackFile pack;
+    REQUIRE(pack.open("pack-test"));
+    CHECK(pack.size() == objects.size());
+    for (const auto& o : objects) {
+        string_view found;
+        REQUIRE(pack.find(o.first, found));
+        CHECK(found == o.second);
+    }
+    string_view none;
+    CHECK(!pack.find(12345, none));
+    auto next = objects.begin();
+    pack.forEach([&](uint64_t h, string_view data) {
+        REQUIRE(next != objects.end());
+        CHECK(h == next->first);
+        CHECK(data == next->second);
+        ++next;
+    });
+    CHECK(next == objects.end());
+}
+
+TEST(PackFile, FailedReadLeavesNoPack) {
+    vector<uint64_t> hashes = {1, 2, 3, 4};
+    bool written = PackFile::write("pack-failed", hashes, [](size_t i, string& out) {
+        out = "object";
+        return i < 2;
+    });
+    CHECK(!written);
+    CHECK(!fs::exists("pack-failed.pack"));
+    CHECK(!fs::exists("pack-failed.idx"));
+    CHECK(!fs::exists("pack-failed.pack.tmp"));
+    CHECK(!fs::exists("pack-failed.idx.tmp"));
+}
+
+#ifndef VCSIM_NO_STATS
+TEST(PackFile, ReachesTheDiskBeforeAndAfterItsRenames) {
+    if (!Sync::enabled()) return;
+    uint64_t before = Stats::get().calls(Stats::SYNC);
+    REQUIRE(PackFile::write("pack-synced", {1, 2}, [](size_t, string& out) { out = "object"; return true; }));
+    CHECK(Stats::get().calls(Stats::SYNC) == before + 2);
+    CHECK(fs::exists("pack-synced.pack") && fs::exists("pack-synced.idx"));
+    CHECK(!fs::exists("pack-synced.pack.tmp") && !fs::exists("pack-synced.idx.tmp"));
+}
+#endif
+
+TEST(ObjectStore, ReadsBackWholeDeltaAndChunkedObjectsFromPacks) {
+    mt19937 rng(4);
+    string text = randomLines(rng, 400), edited = editLines(rng, text);
+    string large = randomBytes(rng, 3 << 20, 256);
+    map<string, string> stored;
+    {
+        ObjectStore store("objects");
+        string whole = store.put(text), delta = store.putDelta(edited, whole);
+        string chunked = store.putChunked([&](const auto& sink) {
+            for (size_t at = 0; at < large.size(); at += 100000) {
+                if (!sink(string_view(large).substr(at, 100000))) return false;
+            }
+            return true;
+        });
+        REQUIRE(!whole.empty());
+        REQUIRE(!delta.empty());
+        REQUIRE(!chunked.empty());
+        char kind;
+        string base;
+        REQUIRE(store.peek(delta, kind, base));
+        CHECK(kind == 'D');
+        CHECK(base == whole);
+        REQUIRE(store.peek(chunked, kind, base));
+        CHECK(kind == 'C');
+        stored = {{whole, text}, {delta, edited}, {chunked, large}};
+
+        ObjectStore::RepackPlan plan;
+        ObjectStore::RepackResult result;
+        REQUIRE(store.repack(plan, result));
+        CHECK(store.packCount() == 1u);
+        CHECK(result.packed > 3u);  // the chunks too
+    }
+    ObjectStore reopened("objects");
+    for (const auto& s : stored) {
+        string out;
+        REQUIRE(reopened.get(s.first, out));
+        CHECK(out == s.second);
+        CHECK(reopened.verify(s.first));
+    }
+    size_t loose = 0;
+    reopened.forEachLoose([&](const string&, const fs::path&) { ++loose; });
+    CHECK(loose == 0u);
+}
+
+TEST(ObjectStore, RefusesDamagedObjectsInsteadOfFollowingThem) {
+    ObjectStore store("objects");
+    auto plant = [&](const string& hash, const string& bytes) { writeFile(store.objectPath(hash), bytes); };
+    auto delta = [](const string& base) { return "D" + base + char(1); };
+    string whole = store.put("text\n");
+    REQUIRE(!whole.empty());
+
+    plant("00000000000000a1", delta("00000000000000a1"));  // its own base
+    plant("00000000000000a2", delta("00000000000000a3"));
+    plant("00000000000000a3", delta("00000000000000a2"));
+    // A chain one longer than any header can record.
+    for (int i = 0; i <= 255; ++i) {
+        char name[17];
+        snprintf(name, sizeof name, "%016x", 0xb00 + i);
+        char base[17];
+        snprintf(base, sizeof base, "%016x", 0xb00 + i + 1);
+        plant(name, delta(i == 255 ? whole : string(base)));
+    }
+    plant("00000000000000a4", delta("../../../etc/pw"));
+    plant("00000000000000a5", "C00000000000000a5 5\n");  // lists itself
+    plant("00000000000000a6", "C" + whole + " 999\n");  // wrong chunk size
+    uint64_t huge = uint64_t(1) << 50;
+    string bomb = string("Z") + char(Codec::byName("lz4")->id()) + string(reinterpret_cast<const char*>(&huge), 8) + "B" + bytes({0x00});
+    plant("00000000000000a7", bomb);
+
+    for (const char* hash : {"00000000000000a1", "00000000000000a2", "0000000000000b00", "00000000000000a4",
+                             "00000000000000a5", "00000000000000a6", "00000000000000a7"}) {
+        string out;
+        CHECK(!store.get(hash, out));
+        CHECK(!store.stream(hash, [](string_view) { return true; }));
+        CHECK(!store.verify(hash));
+    }
+    CHECK(!store.putRaw("00000000000000a8", bomb));
+    CHECK(!store.putRaw("../00000000000a", "Btext"));
+}
+
+// Chunk ends as the chunker finds them over the whole of data.
+static vector<string> chunksOf(const string& data) {
+    vector<string> chunks;
+    for (size_t at = 0; at < data.size();) {
+        size_t n = Chunker::cut(data.data() + at, data.size() - at);
+        chunks.push_back(data.substr(at, n));
+        at += n;
+    }
+    return chunks;
+}
+
+TEST(Chunker, CutsDependOnlyOnTheBytesBeforeThem) {
+    mt19937 rng(5);
+    string data = randomBytes(rng, 24 << 20, 256);
+    vector<string> chunks = chunksOf(data);
+    REQUIRE(chunks.size() > 4);
+    size_t at = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        size_t n = chunks[i].size();
+        if (i + 1 < chunks.size()) CHECK(n > Chunker::MIN && n <= Chunker::MAX);
+        // Whatever follows the cut, the same cut is found.
+        if (n < Chunker::MAX && i + 1 < chunks.size()) CHECK(Chunker::cut(data.data() + at, n + 1) == n);
+        at += n;
+    }
+}
+
+TEST(Chunker, AnEditMovesOnlyTheChunksAroundIt) {
+    mt19937 rng(6);
+    string data = randomBytes(rng, 24 << 20, 256);
+    string edited = data;
+    edited.insert(1000, "inserted near the start");
+    edited.erase(12 << 20, 5000);
+    vector<string> before = chunksOf(data), after = chunksOf(edited);
+    unordered_set<string> old(before.begin(), before.end());
+    size_t shared = 0;
+    for (const string& c : after) shared += old.count(c);
+    // Each edit rewrites the chunk it lands in, and at most the next.
+    CHECK(shared + 4 >= after.size());
+    CHECK(shared + 4 >= before.size());
+}